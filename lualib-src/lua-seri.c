@@ -5,6 +5,7 @@
 #define LUA_LIB
 
 #include "skynet_malloc.h"
+#include "skynet.h"
 
 #include <lua.h>
 #include <lauxlib.h>
@@ -533,7 +534,7 @@ unpack_one(lua_State *L, struct read_block *rb) {
 
 static void
 seri(lua_State *L, struct block *b, int len) {
-	uint8_t * buffer = skynet_malloc(len);
+	uint8_t * buffer = skynet_message_alloc(len);
 	uint8_t * ptr = buffer;
 	int sz = len;
 	while(len>0) {
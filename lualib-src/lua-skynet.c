@@ -2,6 +2,7 @@
 
 #include "skynet.h"
 #include "lua-seri.h"
+#include "atomic.h"
 
 #define KNRM  "\x1B[0m"
 #define KRED  "\x1B[31m"
@@ -74,6 +75,12 @@ _cb(struct skynet_context * context, void * ud, int type, int session, uint32_t
 
 	r = lua_pcall(L, 5, 0 , trace);
 
+#ifdef lua_checksig
+	// the signal (see snlua_signal) arrives after the message finished, drop it.
+	// the one arrives after here is taken back by the monitor (SIGNAL_TIMESLICE_CANCEL).
+	ATOM_CAS_POINTER(&skynet_sig_L, L, NULL);
+#endif
+
 	if (r == LUA_OK) {
 		return 0;
 	}
@@ -120,6 +127,7 @@ lcallback(lua_State *L) {
 		skynet_callback(context, gL, forward_cb);
 	} else {
 		skynet_callback(context, gL, _cb);
+		skynet_callback_noreserve(context);
 	}
 
 	return 0;
@@ -316,6 +324,61 @@ lredirect(lua_State *L) {
 	return send_message(L, source, 3);
 }
 
+/*
+	table addresses
+	integer type
+	string message
+	 lightuserdata message_ptr
+	 integer len
+ */
+static int
+lsendmulti(lua_State *L) {
+	struct skynet_context * context = lua_touserdata(L, lua_upvalueindex(1));
+	luaL_checktype(L, 1, LUA_TTABLE);
+	int n = (int)lua_rawlen(L, 1);
+	int type = luaL_checkinteger(L, 2);
+	// resolve the addresses before the message is sent
+	uint32_t * dest = lua_newuserdata(L, (n > 0 ? n : 1) * sizeof(uint32_t));
+	int i;
+	for (i=0;i<n;i++) {
+		lua_rawgeti(L, 1, i+1);
+		uint32_t des = 0;
+		int t = lua_type(L, -1);
+		if (t == LUA_TNUMBER) {
+			// 0 is skipped by skynet_send_multi
+			des = (uint32_t)lua_tointeger(L, -1);
+		} else if (t == LUA_TSTRING) {
+			des = skynet_queryname(context, lua_tostring(L, -1));
+		}
+		if (des == 0 && t != LUA_TNUMBER) {
+			if (lua_type(L, 3) == LUA_TLIGHTUSERDATA) {
+				// the packed message is ours
+				skynet_free(lua_touserdata(L, 3));
+			}
+			return luaL_error(L, "invalid address at [%d] : %s", i+1, luaL_tolstring(L, -1, NULL));
+		}
+		dest[i] = des;
+		lua_pop(L, 1);
+	}
+	void * msg = NULL;
+	size_t sz = 0;
+	switch (lua_type(L, 3)) {
+	case LUA_TSTRING:
+		msg = (void *)lua_tolstring(L, 3, &sz);
+		break;
+	case LUA_TLIGHTUSERDATA:
+		msg = lua_touserdata(L, 3);
+		sz = luaL_checkinteger(L, 4);
+		type |= PTYPE_TAG_DONTCOPY;
+		break;
+	default:
+		return luaL_error(L, "invalid param %s", lua_typename(L, lua_type(L,3)));
+	}
+	int count = skynet_send_multi(context, 0, dest, n, type, msg, sz);
+	lua_pushinteger(L, count);
+	return 1;
+}
+
 static int
 lerror(lua_State *L) {
 	struct skynet_context * context = lua_touserdata(L, lua_upvalueindex(1));
@@ -384,7 +447,7 @@ ltrash(lua_State *L) {
 	case LUA_TLIGHTUSERDATA: {
 		void * msg = lua_touserdata(L,1);
 		luaL_checkinteger(L,2);
-		skynet_free(msg);
+		skynet_message_free(msg);
 		break;
 	}
 	default:
@@ -482,6 +545,7 @@ luaopen_skynet_core(lua_State *L) {
 		{ "send" , lsend },
 		{ "genid", lgenid },
 		{ "redirect", lredirect },
+		{ "sendmulti", lsendmulti },
 		{ "command" , lcommand },
 		{ "intcommand", lintcommand },
 		{ "addresscommand", laddresscommand },
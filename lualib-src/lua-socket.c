@@ -1,5 +1,6 @@
 #define LUA_LIB
 
+#include "skynet.h"
 #include "skynet_malloc.h"
 
 #include <stdlib.h>
@@ -42,7 +43,7 @@ lfreepool(lua_State *L) {
 	for (i=0;i<sz;i++) {
 		struct buffer_node *node = &pool[i];
 		if (node->msg) {
-			skynet_free(node->msg);
+			skynet_message_free(node->msg);
 			node->msg = NULL;
 		}
 	}
@@ -156,7 +157,7 @@ return_free_node(lua_State *L, int pool, struct socket_buffer *sb) {
 	lua_rawgeti(L,pool,1);
 	free_node->next = lua_touserdata(L,-1);
 	lua_pop(L,1);
-	skynet_free(free_node->msg);
+	skynet_message_free(free_node->msg);
 	free_node->msg = NULL;
 
 	free_node->sz = 0;
@@ -293,7 +294,7 @@ static int
 ldrop(lua_State *L) {
 	void * msg = lua_touserdata(L,1);
 	luaL_checkinteger(L,2);
-	skynet_free(msg);
+	skynet_message_free(msg);
 	return 0;
 }
 
@@ -214,13 +214,41 @@ function suspend(co, result, command, param, param2)
 	end
 end
 
-function skynet.timeout(ti, func)
-	local session = c.intcommand("TIMEOUT",ti)
+local timer_meta = {}
+timer_meta.__index = timer_meta
+
+-- return true if the timer is cancelled before it fires
+function timer_meta:cancel()
+	local session = self.session
+	if session_id_coroutine[session] ~= self.co then
+		-- already fired or cancelled
+		return false
+	end
+	if c.intcommand("CANCEL", session) then
+		session_id_coroutine[session] = nil
+	else
+		-- the timeout message is already on the way, drop it
+		session_id_coroutine[session] = "BREAK"
+	end
+	return true
+end
+
+local function timeout(cmd, ti, func)
+	local session = c.intcommand(cmd,ti)
 	assert(session)
 	local co = co_create(func)
 	assert(session_id_coroutine[session] == nil)
 	session_id_coroutine[session] = co
-	return co	-- for debug
+	return setmetatable({ session = session, co = co }, timer_meta)
+end
+
+function skynet.timeout(ti, func)
+	return timeout("TIMEOUT", ti, func)
+end
+
+-- ti is in millisecond, rounded up to the timer resolution (see timer_resolution in config)
+function skynet.timeout_ms(ti, func)
+	return timeout("TIMEOUTMS", ti, func)
 end
 
 local function suspend_sleep(session, token)
@@ -233,8 +261,8 @@ local function suspend_sleep(session, token)
 	return coroutine_yield "SUSPEND"
 end
 
-function skynet.sleep(ti, token)
-	local session = c.intcommand("TIMEOUT",ti)
+local function sleep(cmd, ti, token)
+	local session = c.intcommand(cmd,ti)
 	assert(session)
 	token = token or coroutine.running()
 	local succ, ret = suspend_sleep(session, token)
@@ -249,6 +277,15 @@ function skynet.sleep(ti, token)
 	end
 end
 
+function skynet.sleep(ti, token)
+	return sleep("TIMEOUT", ti, token)
+end
+
+-- ti is in millisecond, rounded up to the timer resolution (see timer_resolution in config)
+function skynet.sleep_ms(ti, token)
+	return sleep("TIMEOUTMS", ti, token)
+end
+
 function skynet.yield()
 	return skynet.sleep(0)
 end
@@ -352,6 +389,12 @@ function skynet.rawsend(addr, typename, msg, sz)
 	return c.send(addr, p.id, 0 , msg, sz)
 end
 
+-- send one message to a list of addresses, the message is packed and copied only once
+function skynet.sendmulti(addrs, typename, ...)
+	local p = proto[typename]
+	return c.sendmulti(addrs, p.id, p.pack(...))
+end
+
 skynet.genid = assert(c.genid)
 
 skynet.redirect = function(dest,source,typename,...)
@@ -562,19 +605,43 @@ end
 
 local trace_source = {}
 
+local function dispatch_response(session, source, msg, sz)
+	local co = session_id_coroutine[session]
+	if co == "BREAK" then
+		session_id_coroutine[session] = nil
+	elseif co == nil then
+		unknown_response(session, source, msg, sz)
+	else
+		local tag = session_coroutine_tracetag[co]
+		if tag then c.trace(tag, "resume") end
+		session_id_coroutine[session] = nil
+		suspend(co, coroutine_resume(co, true, msg, sz))
+	end
+end
+
 local function raw_dispatch_message(prototype, msg, sz, session, source)
 	-- skynet.PTYPE_RESPONSE = 1, read skynet.h
 	if prototype == 1 then
-		local co = session_id_coroutine[session]
-		if co == "BREAK" then
-			session_id_coroutine[session] = nil
-		elseif co == nil then
-			unknown_response(session, source, msg, sz)
+		if session == 0 and source == 0 then
+			-- coalesced timeouts, msg is an array of sessions (see cmd_timercoalesce in skynet_server.c)
+			-- resume each session in its own pcall, so one failed timeout doesn't lose the others
+			local sessions = c.tostring(msg, sz)
+			local err
+			for i = 1, sz, 4 do
+				local ok, e = pcall(dispatch_response, string.unpack("=i4", sessions, i), 0, nil, 0)
+				if not ok then
+					if err then
+						skynet.error(e)
+					else
+						err = e
+					end
+				end
+			end
+			if err then
+				error(err)
+			end
 		else
-			local tag = session_coroutine_tracetag[co]
-			if tag then c.trace(tag, "resume") end
-			session_id_coroutine[session] = nil
-			suspend(co, coroutine_resume(co, true, msg, sz))
+			dispatch_response(session, source, msg, sz)
 		end
 	else
 		local p = proto[prototype]
@@ -655,6 +722,16 @@ function skynet.newservice(name, ...)
 	return skynet.call(".launcher", "lua" , "LAUNCH", "snlua", name, ...)
 end
 
+-- launch n services at once, return the list of addresses (false for the failed ones)
+function skynet.newservices(name, n, ...)
+	return skynet.call(".launcher", "lua" , "LAUNCHN", n, "snlua", name, ...)
+end
+
+-- launch a service on the workers of pool (declared by pool_<name> = n in config)
+function skynet.poolservice(pool, name, ...)
+	return skynet.call(".launcher", "lua" , "LAUNCH", "@" .. pool, "snlua", name, ...)
+end
+
 function skynet.uniqueservice(global, ...)
 	if global == true then
 		return assert(skynet.call(".service", "lua", "GLAUNCH", ...))
@@ -772,10 +849,11 @@ end
 
 function skynet.start(start_func)
 	c.callback(skynet.dispatch_message)
+	c.command("TIMERCOALESCE")
 	init_thread = skynet.timeout(0, function()
 		skynet.init_service(start_func)
 		init_thread = nil
-	end)
+	end).co
 end
 
 function skynet.endless()
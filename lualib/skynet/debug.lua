@@ -1,5 +1,7 @@
 local table = table
+local c = require "skynet.core"
 local extern_dbgcmd = {}
+local LATENCY_BUCKET = 24	-- see skynet_server.c
 
 local function init(skynet, export)
 	local internal_info_func
@@ -29,6 +31,34 @@ local function init(skynet, export)
 			stat.mqlen = skynet.stat "mqlen"
 			stat.cpu = skynet.stat "cpu"
 			stat.message = skynet.stat "message"
+			stat.batch = skynet.stat "batch"
+			stat.overrun = skynet.stat "overrun"
+			skynet.ret(skynet.pack(stat))
+		end
+
+		-- flag : true (reset and start collecting) / false (stop) / nil (only query)
+		function dbgcmd.LATENCY(flag)
+			if flag ~= nil then
+				c.command("LATENCY", flag and "on" or "off")
+			end
+			local report = c.command("STAT", "latency")
+			local stat = { wait = {}, run = {} }
+			local i = 0
+			for n in report:gmatch "%d+" do
+				i = i + 1
+				local bucket = i
+				local t = stat.wait
+				if i > LATENCY_BUCKET then
+					bucket = i - LATENCY_BUCKET
+					t = stat.run
+				end
+				n = tonumber(n)
+				if n > 0 then
+					-- bucket 1 is < 1us, bucket k is < 2^(k-1) us, the last one is the rest
+					local key = bucket == LATENCY_BUCKET and ">=" .. (1 << (bucket - 2)) .. "us" or "<" .. (1 << (bucket - 1)) .. "us"
+					t[key] = n
+				end
+			end
 			skynet.ret(skynet.pack(stat))
 		end
 
@@ -8,6 +8,19 @@ function skynet.launch(...)
 	end
 end
 
+-- launch n services at once, return the list of n addresses (false for the failed ones)
+function skynet.launchn(n, ...)
+	local addrs = c.command("LAUNCHN", n .. " " .. table.concat({...}," "))
+	if addrs then
+		local list = {}
+		for addr in addrs:gmatch ":(%x+)" do
+			local handle = tonumber("0x" .. addr)
+			list[#list+1] = handle ~= 0 and handle
+		end
+		return list
+	end
+end
+
 function skynet.kill(name)
 	if type(name) == "number" then
 		skynet.send(".launcher","lua","REMOVE",name, true)
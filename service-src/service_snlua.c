@@ -1,4 +1,5 @@
 #include "skynet.h"
+#include "atomic.h"
 
 #include <lua.h>
 #include <lualib.h>
@@ -195,13 +196,27 @@ snlua_release(struct snlua *l) {
 
 void
 snlua_signal(struct snlua *l, int signal) {
+	if (signal == SIGNAL_TIMESLICE) {
+		// the monitor reports it already, and may send it repeatedly until the message breaks.
+#ifdef lua_checksig
+		skynet_sig_L = l->L;
+#endif
+		return;
+	}
+	if (signal == SIGNAL_TIMESLICE_CANCEL) {
+		// only if the vm (or the other service) hasn't taken it
+#ifdef lua_checksig
+		ATOM_CAS_POINTER(&skynet_sig_L, l->L, NULL);
+#endif
+		return;
+	}
 	skynet_error(l->ctx, "recv a signal %d", signal);
-	if (signal == 0) {
+	if (signal == SIGNAL_BREAK) {
 #ifdef lua_checksig
 	// If our lua support signal (modified lua version by skynet), trigger it.
 	skynet_sig_L = l->L;
 #endif
-	} else if (signal == 1) {
+	} else if (signal == SIGNAL_MEMORY) {
 		skynet_error(l->ctx, "Current Memory %.3fK", (float)l->mem / 1024);
 	}
 }
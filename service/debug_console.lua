@@ -160,6 +160,8 @@ function COMMAND.help()
 		call = "call address ...",
 		trace = "trace address [proto] [on|off]",
 		netstat = "netstat : show netstat",
+		latency = "latency address [on|off] : show queue wait and callback time histogram",
+		schedtrace = "schedtrace on|off|dump filename : trace the scheduler, dump as chrome trace json",
 	}
 end
 
@@ -364,6 +366,23 @@ function COMMAND.trace(address, proto, flag)
 	skynet.call(address, "debug", "TRACELOG", proto, flag)
 end
 
+function COMMAND.latency(address, flag)
+	address = adjust_address(address)
+	if flag ~= nil then
+		flag = toboolean(flag)
+	end
+	return skynet.call(address, "debug", "LATENCY", flag)
+end
+
+function COMMAND.schedtrace(cmd, filename)
+	if cmd == "dump" then
+		local n = core.command("SCHEDTRACE", "dump " .. assert(filename, "need filename"))
+		return assert(n, "dump failed") .. " events"
+	end
+	assert(cmd == "on" or cmd == "off", "schedtrace on|off|dump filename")
+	core.command("SCHEDTRACE", cmd)
+end
+
 function COMMANDX.call(cmd)
 	local address = adjust_address(cmd[2])
 	local cmdline = assert(cmd[1]:match("%S+%s+%S+%s(.+)") , "need arguments")
@@ -97,6 +97,41 @@ function command.LAUNCH(_, service, ...)
 	return NORET
 end
 
+function command.LAUNCHN(_, n, service, ...)
+	local param = table.concat({...}, " ")
+	local insts = skynet.launchn(n, service, param)
+	local session = skynet.context()
+	local response = skynet.response()
+	if not insts or #insts == 0 then
+		response(false)
+		return NORET
+	end
+	local result = {}
+	local pending = 0
+	for i, inst in ipairs(insts) do
+		if inst then
+			pending = pending + 1
+			services[inst] = service .. " " .. param
+			-- response to the caller after all the services init (or fail)
+			instance[inst] = function(ok)
+				result[i] = ok and inst or false
+				pending = pending - 1
+				if pending == 0 then
+					response(true, result)
+				end
+			end
+			launch_session[inst] = session
+		else
+			-- init failed in launchn
+			result[i] = false
+		end
+	end
+	if pending == 0 then
+		response(true, result)
+	end
+	return NORET
+end
+
 function command.LOGLAUNCH(_, service, ...)
 	local inst = launch_service(service, ...)
 	if inst then
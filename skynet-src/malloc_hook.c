@@ -4,6 +4,9 @@
 #include <stdlib.h>
 #include <lua.h>
 #include <stdio.h>
+#if defined(__linux__)
+#include <malloc.h>
+#endif
 
 #include "malloc_hook.h"
 #include "skynet.h"
@@ -162,6 +165,30 @@ mallctl_opt(const char* name, int* newval) {
 	return v;
 }
 
+size_t
+malloc_usable(void *ptr) {
+	return je_malloc_usable_size(ptr) - PREFIX_SIZE;
+}
+
+void
+malloc_rehandle(void *ptr, uint32_t handle) {
+	size_t size = je_malloc_usable_size(ptr);
+	struct mem_cookie *p = (struct mem_cookie *)((char *)ptr + size - sizeof(struct mem_cookie));
+	uint32_t old_handle;
+	memcpy(&old_handle, &p->handle, sizeof(old_handle));
+	if (old_handle == handle)
+		return;
+	memcpy(&p->handle, &handle, sizeof(handle));
+	ssize_t* allocated = get_allocated_field(old_handle);
+	if(allocated) {
+		ATOM_SUB(allocated, size);
+	}
+	allocated = get_allocated_field(handle);
+	if(allocated) {
+		ATOM_ADD(allocated, size);
+	}
+}
+
 // hook : malloc, realloc, free, calloc
 
 void *
@@ -240,6 +267,19 @@ mallctl_opt(const char* name, int* newval) {
 	return 0;
 }
 
+size_t
+malloc_usable(void *ptr) {
+#if defined(__linux__)
+	return malloc_usable_size(ptr);
+#else
+	return 0;
+#endif
+}
+
+void
+malloc_rehandle(void *ptr, uint32_t handle) {
+}
+
 #endif
 
 size_t
@@ -2,6 +2,7 @@
 #define SKYNET_MALLOC_HOOK_H
 
 #include <stdlib.h>
+#include <stdint.h>
 #include <lua.h>
 
 extern size_t malloc_used_memory(void);
@@ -12,6 +13,10 @@ extern int    mallctl_opt(const char* name, int* newval);
 extern void   dump_c_mem(void);
 extern int    dump_mem_lua(lua_State *L);
 extern size_t malloc_current_memory(void);
+// usable size of a block allocated by skynet_malloc, 0 means unknown
+extern size_t malloc_usable(void *ptr);
+// charge the block allocated by skynet_malloc to handle in the memory stats of services
+extern void   malloc_rehandle(void *ptr, uint32_t handle);
 
 #endif /* SKYNET_MALLOC_HOOK_H */
 
@@ -0,0 +1,92 @@
+#ifndef SKYNET_PARKING_H
+#define SKYNET_PARKING_H
+
+#include "atomic.h"
+
+// A parking slot for one thread.
+// state 1 means the thread is parked (or going to park), the waker sets it to 0 (by CAS) and then calls parking_wake.
+// Use futex on linux, and mutex/cond for other platforms.
+
+static inline void
+cpu_relax(void) {
+#if defined(__i386__) || defined(__x86_64__)
+	__asm__ __volatile__ ("pause");
+#elif defined(__aarch64__)
+	__asm__ __volatile__ ("yield");
+#endif
+}
+
+#if defined(__linux__)
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+struct parking {
+	int state;
+};
+
+static inline void
+parking_init(struct parking *p) {
+	p->state = 0;
+}
+
+static inline void
+parking_destroy(struct parking *p) {
+	(void) p;
+}
+
+static inline void
+parking_wait(struct parking *p) {
+	while (ATOM_LOAD(&p->state) == 1) {
+		syscall(SYS_futex, &p->state, FUTEX_WAIT_PRIVATE, 1, NULL, NULL, 0);
+	}
+}
+
+static inline void
+parking_wake(struct parking *p) {
+	syscall(SYS_futex, &p->state, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+#else
+
+#include <pthread.h>
+
+struct parking {
+	int state;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+};
+
+static inline void
+parking_init(struct parking *p) {
+	p->state = 0;
+	pthread_mutex_init(&p->mutex, NULL);
+	pthread_cond_init(&p->cond, NULL);
+}
+
+static inline void
+parking_destroy(struct parking *p) {
+	pthread_mutex_destroy(&p->mutex);
+	pthread_cond_destroy(&p->cond);
+}
+
+static inline void
+parking_wait(struct parking *p) {
+	pthread_mutex_lock(&p->mutex);
+	while (ATOM_LOAD(&p->state) == 1) {
+		pthread_cond_wait(&p->cond, &p->mutex);
+	}
+	pthread_mutex_unlock(&p->mutex);
+}
+
+static inline void
+parking_wake(struct parking *p) {
+	pthread_mutex_lock(&p->mutex);
+	pthread_cond_signal(&p->cond);
+	pthread_mutex_unlock(&p->mutex);
+}
+
+#endif
+
+#endif
@@ -21,6 +21,12 @@
 #define PTYPE_RESERVED_LUA 10
 #define PTYPE_RESERVED_SNAX 11
 
+// signals of skynet_context_signal, see snlua_signal in service_snlua.c
+#define SIGNAL_BREAK 0
+#define SIGNAL_MEMORY 1
+#define SIGNAL_TIMESLICE 2
+#define SIGNAL_TIMESLICE_CANCEL 3	// the message has finished, take back SIGNAL_TIMESLICE
+
 #define PTYPE_TAG_DONTCOPY 0x10000
 #define PTYPE_TAG_ALLOCSESSION 0x20000
 
@@ -31,14 +37,24 @@ const char * skynet_command(struct skynet_context * context, const char * cmd ,
 uint32_t skynet_queryname(struct skynet_context * context, const char * name);
 int skynet_send(struct skynet_context * context, uint32_t source, uint32_t destination , int type, int session, void * msg, size_t sz);
 int skynet_sendname(struct skynet_context * context, uint32_t source, const char * destination , int type, int session, void * msg, size_t sz);
+// send msg to n destinations without session. msg is copied once and shared (refcounted) by the receivers
+// declared by skynet_callback_noreserve, the others get a copy before the callback.
+// return the number of messages sent, or -1 for error.
+int skynet_send_multi(struct skynet_context * context, uint32_t source, const uint32_t * destination, int n, int type, void * msg, size_t sz);
 
 int skynet_isremote(struct skynet_context *, uint32_t handle, int * harbor);
 
 typedef int (*skynet_cb)(struct skynet_context * context, void *ud, int type, int session, uint32_t source , const void * msg, size_t sz);
 void skynet_callback(struct skynet_context * context, void *ud, skynet_cb cb);
+// declare the callback set last never reserves a message (always returns 0)
+void skynet_callback_noreserve(struct skynet_context * context);
 
 uint32_t skynet_current_handle(void);
 uint64_t skynet_now(void);
 void skynet_debug_memory(const char *info);	// for debug use, output current service memory to stderr
+// allocate a buffer for message (free by skynet_free), the small buffers are recycled by worker threads
+void * skynet_message_alloc(size_t sz);
+// free a message buffer, and keep it for reuse if it's small
+void skynet_message_free(void *ptr);
 
 #endif
@@ -0,0 +1,164 @@
+#if defined(__linux__)
+#define _GNU_SOURCE
+#endif
+
+#include "skynet.h"
+#include "skynet_affinity.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__linux__)
+#include <sched.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#endif
+
+int
+skynet_affinity_parse(const char *list, int *cpus, int n) {
+	int count = 0;
+	const char *p = list;
+	while (*p) {
+		char *end;
+		long from = strtol(p, &end, 10);
+		if (end == p || from < 0)
+			return -1;
+		long to = from;
+		p = end;
+		if (*p == '-') {
+			++p;
+			to = strtol(p, &end, 10);
+			if (end == p || to < from)
+				return -1;
+			p = end;
+		}
+		long i;
+		for (i=from;i<=to;i++) {
+			if (count >= n)
+				return count;
+			cpus[count++] = (int)i;
+		}
+		while (*p == ' ')
+			++p;
+		if (*p == ',') {
+			++p;
+		} else if (*p) {
+			return -1;
+		}
+	}
+	return count;
+}
+
+#if defined(__linux__)
+
+int
+skynet_affinity_valid(int cpu) {
+	if (cpu < 0 || cpu >= CPU_SETSIZE)
+		return 0;
+	// the cpus out of the affinity mask of the process (offline or excluded by cpuset) make pthread_create fail
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	if (sched_getaffinity(0, sizeof(set), &set))
+		return cpu < sysconf(_SC_NPROCESSORS_ONLN);
+	return CPU_ISSET(cpu, &set) != 0;
+}
+
+int
+skynet_affinity_attr(pthread_attr_t *attr, int cpu) {
+	if (cpu < 0)
+		return 0;
+	if (cpu >= CPU_SETSIZE)
+		return -1;
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	return pthread_attr_setaffinity_np(attr, sizeof(set), &set);
+}
+
+int
+skynet_affinity_node(int cpu) {
+	char path[64];
+	sprintf(path, "/sys/devices/system/cpu/cpu%d", cpu);
+	DIR *dir = opendir(path);
+	if (dir == NULL)
+		return -1;
+	int node = -1;
+	struct dirent *ent;
+	while ((ent = readdir(dir))) {
+		if (strncmp(ent->d_name, "node", 4) == 0) {
+			char *end;
+			long n = strtol(ent->d_name + 4, &end, 10);
+			if (end != ent->d_name + 4 && *end == '\0') {
+				node = (int)n;
+				break;
+			}
+		}
+	}
+	closedir(dir);
+	return node;
+}
+
+static size_t
+page_align(size_t sz) {
+	size_t page = (size_t)sysconf(_SC_PAGESIZE);
+	return (sz + page - 1) & ~(page - 1);
+}
+
+void *
+skynet_affinity_alloc(size_t sz, int node) {
+	sz = page_align(sz);
+	void *ptr = mmap(NULL, sz, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (ptr == MAP_FAILED) {
+		fprintf(stderr, "mmap %d bytes failed\n", (int)sz);
+		exit(1);
+	}
+	if (node >= 0 && node < (int)sizeof(unsigned long) * 8) {
+		unsigned long mask = 1UL << node;
+		// It's only a hint, the pages are on any node if it fails.
+		syscall(SYS_mbind, ptr, sz, MPOL_PREFERRED, &mask, sizeof(mask) * 8, 0);
+	}
+	// mmap returns zeroed pages, touch them after mbind
+	memset(ptr, 0, sz);
+	return ptr;
+}
+
+void
+skynet_affinity_free(void *ptr, size_t sz) {
+	munmap(ptr, page_align(sz));
+}
+
+#else
+
+int
+skynet_affinity_valid(int cpu) {
+	return 0;
+}
+
+int
+skynet_affinity_attr(pthread_attr_t *attr, int cpu) {
+	return cpu < 0 ? 0 : -1;
+}
+
+int
+skynet_affinity_node(int cpu) {
+	return -1;
+}
+
+void *
+skynet_affinity_alloc(size_t sz, int node) {
+	void *ptr = skynet_malloc(sz);
+	memset(ptr, 0, sz);
+	return ptr;
+}
+
+void
+skynet_affinity_free(void *ptr, size_t sz) {
+	skynet_free(ptr);
+}
+
+#endif
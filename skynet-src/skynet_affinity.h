@@ -0,0 +1,20 @@
+#ifndef SKYNET_AFFINITY_H
+#define SKYNET_AFFINITY_H
+
+#include <pthread.h>
+#include <stddef.h>
+
+// parse cpu list like "0-3,8,10-11" into cpus (at most n), return the number of cpus, -1 for syntax error
+int skynet_affinity_parse(const char *list, int *cpus, int n);
+// return 1 if the thread can be bound to cpu (it's less than CPU_SETSIZE and usable by the process)
+int skynet_affinity_valid(int cpu);
+// bind the thread created with attr to cpu, return 0 for success (cpu < 0 means no affinity)
+int skynet_affinity_attr(pthread_attr_t *attr, int cpu);
+// return the numa node of cpu, -1 for unknown
+int skynet_affinity_node(int cpu);
+
+// allocate zeroed memory on numa node (node < 0 means any node)
+void * skynet_affinity_alloc(size_t sz, int node);
+void skynet_affinity_free(void *ptr, size_t sz);
+
+#endif
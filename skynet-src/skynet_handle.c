@@ -3,17 +3,53 @@
 #include "skynet_handle.h"
 #include "skynet_server.h"
 #include "rwlock.h"
+#include "spinlock.h"
+#include "atomic.h"
 
+#include <pthread.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
 #include <string.h>
 
 #define DEFAULT_SLOT_SIZE 4
 #define MAX_SLOT_SIZE 0x40000000
+#define DEFAULT_NAME_SIZE 16
 
+// The names are indexed by name (bucket) and by handle (bucket_handle),
+// so register, find and retire are all O(1).
 struct handle_name {
 	char * name;
 	uint32_t handle;
+	uint32_t hash;
+	struct handle_name *next;	// in the same bucket of name
+	struct handle_name *next_handle;	// in the same bucket of handle
+};
+
+// skynet_handle_grab is lock-free : the slot table is published by an atomic pointer,
+// and the old tables (and the freed contexts) are reclaimed by epoch.
+// A reader only writes its own epoch record, the writers are still serialized by the rwlock.
+
+struct handle_slot {
+	int size;
+	struct skynet_context * slot[1];
+};
+
+struct epoch_record {
+	uint64_t active;	// the epoch when the thread enters, 0 means quiescent
+	struct epoch_record *next;
+} __attribute__ ((aligned (64)));
+
+struct limbo {
+	struct limbo *next;
+	uint64_t epoch;	// the epoch when ptr retires
+	void * ptr;
+};
+
+struct limbo_list {
+	struct spinlock lock;
+	struct limbo *head;
+	struct limbo *tail;
 };
 
 struct handle_storage {
@@ -21,49 +57,225 @@ struct handle_storage {
 
 	uint32_t harbor;
 	uint32_t handle_index;
-	int slot_size;
-	struct skynet_context ** slot;
+	int slot_count;	// number of handles registered
+	struct handle_slot *slot;
 	
-	int name_cap;
+	int name_cap;	// size of the buckets, power of 2
 	int name_count;
-	struct handle_name *name;
+	struct handle_name **bucket;
+	struct handle_name **bucket_handle;
+
+	uint64_t epoch;
+	struct epoch_record *record;
+	pthread_key_t record_key;
+	struct limbo_list limbo;
 };
 
 static struct handle_storage *H = NULL;
 
-uint32_t
-skynet_handle_register(struct skynet_context *ctx) {
-	struct handle_storage *s = H;
+static struct epoch_record *
+epoch_record(struct handle_storage *s) {
+	struct epoch_record *r = pthread_getspecific(s->record_key);
+	if (r == NULL) {
+		// the records are never freed, there are only a few threads.
+		r = skynet_malloc(sizeof(*r));
+		memset(r, 0, sizeof(*r));
+		do {
+			r->next = s->record;
+		} while (!ATOM_CAS_POINTER(&s->record, r->next, r));
+		pthread_setspecific(s->record_key, r);
+	}
+	return r;
+}
 
-	rwlock_wlock(&s->lock);
-	
+static inline struct epoch_record *
+epoch_enter(struct handle_storage *s) {
+	struct epoch_record *r = epoch_record(s);
+	r->active = ATOM_LOAD(&s->epoch);
+	// pair with the barrier in reclaim, the writer sees active or we see the new slot
+	__sync_synchronize();
+	return r;
+}
+
+static inline void
+epoch_exit(struct epoch_record *r) {
+	ATOM_STORE(&r->active, 0);
+}
+
+static void
+reclaim(struct handle_storage *s) {
+	// free the pointers retired before all the active readers
+	__sync_synchronize();
+	uint64_t min = ATOM_LOAD(&s->epoch);
+	struct epoch_record *r;
+	for (r = ATOM_LOAD(&s->record); r; r = r->next) {
+		uint64_t e = ATOM_LOAD(&r->active);
+		if (e && e < min) {
+			min = e;
+		}
+	}
+	struct limbo *free_list = NULL;
+	SPIN_LOCK(&s->limbo)
+	while (s->limbo.head && s->limbo.head->epoch < min) {
+		struct limbo *l = s->limbo.head;
+		s->limbo.head = l->next;
+		l->next = free_list;
+		free_list = l;
+	}
+	if (s->limbo.head == NULL) {
+		s->limbo.tail = NULL;
+	}
+	SPIN_UNLOCK(&s->limbo)
+	while (free_list) {
+		struct limbo *l = free_list;
+		free_list = l->next;
+		skynet_free(l->ptr);
+		skynet_free(l);
+	}
+}
+
+static void
+retire_ptr(struct handle_storage *s, void *ptr) {
+	struct limbo *l = skynet_malloc(sizeof(*l));
+	l->next = NULL;
+	l->ptr = ptr;
+	SPIN_LOCK(&s->limbo)
+	l->epoch = s->epoch;
+	if (s->limbo.tail) {
+		s->limbo.tail->next = l;
+	} else {
+		s->limbo.head = l;
+	}
+	s->limbo.tail = l;
+	SPIN_UNLOCK(&s->limbo)
+	// The readers entered since now can't see ptr
+	ATOM_INC(&s->epoch);
+	reclaim(s);
+}
+
+static struct handle_slot *
+slot_new(int size) {
+	struct handle_slot *hs = skynet_malloc(sizeof(*hs) + (size - 1) * sizeof(struct skynet_context *));
+	hs->size = size;
+	memset(hs->slot, 0, size * sizeof(struct skynet_context *));
+	return hs;
+}
+
+void
+skynet_handle_free(void *ptr) {
+	retire_ptr(H, ptr);
+}
+
+static uint32_t
+name_hash(const char * name) {
+	// FNV-1a
+	uint32_t h = 2166136261u;
+	const unsigned char *p = (const unsigned char *)name;
+	while (*p) {
+		h ^= *p++;
+		h *= 16777619u;
+	}
+	return h;
+}
+
+static void
+_unlink_name(struct handle_storage *s, struct handle_name *target) {
+	struct handle_name **pn = &s->bucket[target->hash & (s->name_cap-1)];
+	while (*pn != target) {
+		pn = &(*pn)->next;
+	}
+	*pn = target->next;
+}
+
+// remove all the names of handle
+static void
+_remove_names(struct handle_storage *s, uint32_t handle) {
+	struct handle_name **pn = &s->bucket_handle[handle & (s->name_cap-1)];
+	while (*pn) {
+		struct handle_name *n = *pn;
+		if (n->handle == handle) {
+			*pn = n->next_handle;
+			_unlink_name(s, n);
+			skynet_free(n->name);
+			skynet_free(n);
+			--s->name_count;
+		} else {
+			pn = &n->next_handle;
+		}
+	}
+}
+
+static void
+_expand_slot(struct handle_storage *s, int size) {
+	struct handle_slot *hs = s->slot;
+	assert((size - 1) <= HANDLE_MASK);
+	struct handle_slot *new_slot = slot_new(size);
+	int i;
+	for (i=0;i<hs->size;i++) {
+		if (hs->slot[i]) {
+			int hash = skynet_context_handle(hs->slot[i]) & (new_slot->size - 1);
+			assert(new_slot->slot[hash] == NULL);
+			new_slot->slot[hash] = hs->slot[i];
+		}
+	}
+	ATOM_STORE(&s->slot, new_slot);
+	retire_ptr(s, hs);
+}
+
+static uint32_t
+_register(struct handle_storage *s, struct skynet_context *ctx) {
 	for (;;) {
+		struct handle_slot *hs = s->slot;
 		int i;
-		for (i=0;i<s->slot_size;i++) {
+		for (i=0;i<hs->size;i++) {
 			uint32_t handle = (i+s->handle_index) & HANDLE_MASK;
-			int hash = handle & (s->slot_size-1);
-			if (s->slot[hash] == NULL) {
-				s->slot[hash] = ctx;
+			int hash = handle & (hs->size-1);
+			if (hs->slot[hash] == NULL) {
+				// ctx->handle is set by the caller later, grab checks the handle so it can't get ctx before that.
+				ATOM_STORE(&hs->slot[hash], ctx);
 				s->handle_index = handle + 1;
+				++s->slot_count;
 
-				rwlock_wunlock(&s->lock);
-
-				handle |= s->harbor;
-				return handle;
+				return handle | s->harbor;
 			}
 		}
-		assert((s->slot_size*2 - 1) <= HANDLE_MASK);
-		struct skynet_context ** new_slot = skynet_malloc(s->slot_size * 2 * sizeof(struct skynet_context *));
-		memset(new_slot, 0, s->slot_size * 2 * sizeof(struct skynet_context *));
-		for (i=0;i<s->slot_size;i++) {
-			int hash = skynet_context_handle(s->slot[i]) & (s->slot_size * 2 - 1);
-			assert(new_slot[hash] == NULL);
-			new_slot[hash] = s->slot[i];
-		}
-		skynet_free(s->slot);
-		s->slot = new_slot;
-		s->slot_size *= 2;
+		_expand_slot(s, hs->size * 2);
+	}
+}
+
+uint32_t
+skynet_handle_register(struct skynet_context *ctx) {
+	struct handle_storage *s = H;
+
+	rwlock_wlock(&s->lock);
+
+	uint32_t handle = _register(s, ctx);
+
+	rwlock_wunlock(&s->lock);
+
+	return handle;
+}
+
+void
+skynet_handle_register_batch(struct skynet_context **ctx, int n, uint32_t *handle) {
+	struct handle_storage *s = H;
+
+	rwlock_wlock(&s->lock);
+
+	// pre-size the slot table, so it rehashes at most once
+	int size = s->slot->size;
+	while (size < s->slot_count + n) {
+		size *= 2;
+	}
+	if (size > s->slot->size) {
+		_expand_slot(s, size);
+	}
+	int i;
+	for (i=0;i<n;i++) {
+		handle[i] = _register(s, ctx[i]);
 	}
+
+	rwlock_wunlock(&s->lock);
 }
 
 int
@@ -73,24 +285,15 @@ skynet_handle_retire(uint32_t handle) {
 
 	rwlock_wlock(&s->lock);
 
-	uint32_t hash = handle & (s->slot_size-1);
-	struct skynet_context * ctx = s->slot[hash];
+	struct handle_slot *hs = s->slot;
+	uint32_t hash = handle & (hs->size-1);
+	struct skynet_context * ctx = hs->slot[hash];
 
 	if (ctx != NULL && skynet_context_handle(ctx) == handle) {
-		s->slot[hash] = NULL;
+		ATOM_STORE(&hs->slot[hash], NULL);
+		--s->slot_count;
 		ret = 1;
-		int i;
-		int j=0, n=s->name_count;
-		for (i=0; i<n; ++i) {
-			if (s->name[i].handle == handle) {
-				skynet_free(s->name[i].name);
-				continue;
-			} else if (i!=j) {
-				s->name[j] = s->name[i];
-			}
-			++j;
-		}
-		s->name_count = j;
+		_remove_names(s, handle);
 	} else {
 		ctx = NULL;
 	}
@@ -111,13 +314,18 @@ skynet_handle_retireall() {
 	for (;;) {
 		int n=0;
 		int i;
-		for (i=0;i<s->slot_size;i++) {
-			rwlock_rlock(&s->lock);
-			struct skynet_context * ctx = s->slot[i];
+		for (i=0;;i++) {
+			struct epoch_record *r = epoch_enter(s);
+			struct handle_slot *hs = ATOM_LOAD(&s->slot);
+			if (i >= hs->size) {
+				epoch_exit(r);
+				break;
+			}
+			struct skynet_context * ctx = ATOM_LOAD(&hs->slot[i]);
 			uint32_t handle = 0;
 			if (ctx)
 				handle = skynet_context_handle(ctx);
-			rwlock_runlock(&s->lock);
+			epoch_exit(r);
 			if (handle != 0) {
 				if (skynet_handle_retire(handle)) {
 					++n;
@@ -134,16 +342,17 @@ skynet_handle_grab(uint32_t handle) {
 	struct handle_storage *s = H;
 	struct skynet_context * result = NULL;
 
-	rwlock_rlock(&s->lock);
+	struct epoch_record *r = epoch_enter(s);
 
-	uint32_t hash = handle & (s->slot_size-1);
-	struct skynet_context * ctx = s->slot[hash];
-	if (ctx && skynet_context_handle(ctx) == handle) {
+	struct handle_slot *hs = ATOM_LOAD(&s->slot);
+	uint32_t hash = handle & (hs->size-1);
+	struct skynet_context * ctx = ATOM_LOAD(&hs->slot[hash]);
+	// ctx may be released by others now, but the memory is reclaimed after epoch_exit.
+	if (ctx && skynet_context_handle(ctx) == handle && skynet_context_trygrab(ctx)) {
 		result = ctx;
-		skynet_context_grab(result);
 	}
 
-	rwlock_runlock(&s->lock);
+	epoch_exit(r);
 
 	return result;
 }
@@ -155,22 +364,14 @@ skynet_handle_findname(const char * name) {
 	rwlock_rlock(&s->lock);
 
 	uint32_t handle = 0;
-
-	int begin = 0;
-	int end = s->name_count - 1;
-	while (begin<=end) {
-		int mid = (begin+end)/2;
-		struct handle_name *n = &s->name[mid];
-		int c = strcmp(n->name, name);
-		if (c==0) {
+	uint32_t h = name_hash(name);
+	struct handle_name *n = s->bucket[h & (s->name_cap-1)];
+	while (n) {
+		if (n->hash == h && strcmp(n->name, name) == 0) {
 			handle = n->handle;
 			break;
 		}
-		if (c<0) {
-			begin = mid + 1;
-		} else {
-			end = mid - 1;
-		}
+		n = n->next;
 	}
 
 	rwlock_runlock(&s->lock);
@@ -179,53 +380,60 @@ skynet_handle_findname(const char * name) {
 }
 
 static void
-_insert_name_before(struct handle_storage *s, char *name, uint32_t handle, int before) {
-	if (s->name_count >= s->name_cap) {
-		s->name_cap *= 2;
-		assert(s->name_cap <= MAX_SLOT_SIZE);
-		struct handle_name * n = skynet_malloc(s->name_cap * sizeof(struct handle_name));
-		int i;
-		for (i=0;i<before;i++) {
-			n[i] = s->name[i];
-		}
-		for (i=before;i<s->name_count;i++) {
-			n[i+1] = s->name[i];
-		}
-		skynet_free(s->name);
-		s->name = n;
-	} else {
-		int i;
-		for (i=s->name_count;i>before;i--) {
-			s->name[i] = s->name[i-1];
+_expand_name(struct handle_storage *s) {
+	int cap = s->name_cap * 2;
+	assert(cap <= MAX_SLOT_SIZE);
+	struct handle_name ** bucket = skynet_malloc(cap * sizeof(struct handle_name *));
+	struct handle_name ** bucket_handle = skynet_malloc(cap * sizeof(struct handle_name *));
+	memset(bucket, 0, cap * sizeof(struct handle_name *));
+	memset(bucket_handle, 0, cap * sizeof(struct handle_name *));
+	int i;
+	for (i=0;i<s->name_cap;i++) {
+		struct handle_name *n = s->bucket[i];
+		while (n) {
+			struct handle_name *next = n->next;
+			int b = n->hash & (cap-1);
+			n->next = bucket[b];
+			bucket[b] = n;
+			b = n->handle & (cap-1);
+			n->next_handle = bucket_handle[b];
+			bucket_handle[b] = n;
+			n = next;
 		}
 	}
-	s->name[before].name = name;
-	s->name[before].handle = handle;
-	s->name_count ++;
+	skynet_free(s->bucket);
+	skynet_free(s->bucket_handle);
+	s->bucket = bucket;
+	s->bucket_handle = bucket_handle;
+	s->name_cap = cap;
 }
 
 static const char *
 _insert_name(struct handle_storage *s, const char * name, uint32_t handle) {
-	int begin = 0;
-	int end = s->name_count - 1;
-	while (begin<=end) {
-		int mid = (begin+end)/2;
-		struct handle_name *n = &s->name[mid];
-		int c = strcmp(n->name, name);
-		if (c==0) {
+	uint32_t h = name_hash(name);
+	struct handle_name *n = s->bucket[h & (s->name_cap-1)];
+	while (n) {
+		if (n->hash == h && strcmp(n->name, name) == 0) {
 			return NULL;
 		}
-		if (c<0) {
-			begin = mid + 1;
-		} else {
-			end = mid - 1;
-		}
+		n = n->next;
 	}
-	char * result = skynet_strdup(name);
-
-	_insert_name_before(s, result, handle, begin);
+	if (s->name_count >= s->name_cap) {
+		_expand_name(s);
+	}
+	n = skynet_malloc(sizeof(*n));
+	n->name = skynet_strdup(name);
+	n->handle = handle;
+	n->hash = h;
+	int b = h & (s->name_cap-1);
+	n->next = s->bucket[b];
+	s->bucket[b] = n;
+	b = handle & (s->name_cap-1);
+	n->next_handle = s->bucket_handle[b];
+	s->bucket_handle[b] = n;
+	s->name_count ++;
 
-	return result;
+	return n->name;
 }
 
 const char * 
@@ -243,17 +451,25 @@ void
 skynet_handle_init(int harbor) {
 	assert(H==NULL);
 	struct handle_storage * s = skynet_malloc(sizeof(*H));
-	s->slot_size = DEFAULT_SLOT_SIZE;
-	s->slot = skynet_malloc(s->slot_size * sizeof(struct skynet_context *));
-	memset(s->slot, 0, s->slot_size * sizeof(struct skynet_context *));
+	memset(s, 0, sizeof(*s));
+	s->slot = slot_new(DEFAULT_SLOT_SIZE);
+	s->epoch = 1;
+	SPIN_INIT(&s->limbo)
+	if (pthread_key_create(&s->record_key, NULL)) {
+		fprintf(stderr, "pthread_key_create failed");
+		exit(1);
+	}
 
 	rwlock_init(&s->lock);
 	// reserve 0 for system
 	s->harbor = (uint32_t) (harbor & 0xff) << HANDLE_REMOTE_SHIFT;
 	s->handle_index = 1;
-	s->name_cap = 2;
+	s->name_cap = DEFAULT_NAME_SIZE;
 	s->name_count = 0;
-	s->name = skynet_malloc(s->name_cap * sizeof(struct handle_name));
+	s->bucket = skynet_malloc(s->name_cap * sizeof(struct handle_name *));
+	s->bucket_handle = skynet_malloc(s->name_cap * sizeof(struct handle_name *));
+	memset(s->bucket, 0, s->name_cap * sizeof(struct handle_name *));
+	memset(s->bucket_handle, 0, s->name_cap * sizeof(struct handle_name *));
 
 	H = s;
 
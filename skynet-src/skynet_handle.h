@@ -10,9 +10,13 @@
 struct skynet_context;
 
 uint32_t skynet_handle_register(struct skynet_context *);
+// register n contexts under one lock
+void skynet_handle_register_batch(struct skynet_context **ctx, int n, uint32_t *handle);
 int skynet_handle_retire(uint32_t handle);
 struct skynet_context * skynet_handle_grab(uint32_t handle);
 void skynet_handle_retireall();
+// free ptr after all the skynet_handle_grab running now finish, for the memory of skynet_context
+void skynet_handle_free(void *ptr);
 
 uint32_t skynet_handle_findname(const char * name);
 const char * skynet_handle_namehandle(uint32_t handle, const char *name);
@@ -1,15 +1,30 @@
 #ifndef SKYNET_IMP_H
 #define SKYNET_IMP_H
 
+#define MAX_POOL 16
+
 struct skynet_config {
 	int thread;
+	int pools;	// pool 0 is the default pool with thread workers, others are declared by pool_<name> = n
+	const char * pool_name[MAX_POOL];
+	int pool_thread[MAX_POOL];
 	int harbor;
 	int profile;
+	int latency;
 	const char * daemon;
 	const char * module_path;
 	const char * bootstrap;
 	const char * logger;
 	const char * logservice;
+	const char * worker_cpu;
+	const char * socket_cpu;
+	int timer_cpu;
+	int dispatch_budget;
+	int timer_coalesce;
+	int timer_tickless;
+	int timer_resolution;
+	int time_slice;
+	int socket_thread;
 };
 
 #define THREAD_WORKER 0
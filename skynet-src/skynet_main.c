@@ -75,6 +75,37 @@ _init_env(lua_State *L) {
 	lua_pop(L,1);
 }
 
+static void
+_init_pool(lua_State *L, struct skynet_config *config) {
+	config->pools = 1;
+	config->pool_name[0] = "default";
+	lua_pushnil(L);
+	while (lua_next(L, -2) != 0) {
+		const char * key = lua_type(L,-2) == LUA_TSTRING ? lua_tostring(L,-2) : NULL;
+		if (key && strncmp(key, "pool_", 5) == 0) {
+			int n = (int)lua_tointeger(L,-1);
+			if (n <= 0 || key[5] == '\0' || strcmp(key+5, "default") == 0) {
+				fprintf(stderr, "Invalid config %s\n", key);
+				exit(1);
+			}
+			if (config->pools >= MAX_POOL) {
+				fprintf(stderr, "Too many pools (max %d)\n", MAX_POOL - 1);
+				exit(1);
+			}
+			// keep the pools in name order, so the worker ids are stable.
+			int i = config->pools++;
+			while (i > 1 && strcmp(config->pool_name[i-1], key+5) > 0) {
+				config->pool_name[i] = config->pool_name[i-1];
+				config->pool_thread[i] = config->pool_thread[i-1];
+				--i;
+			}
+			config->pool_name[i] = skynet_strdup(key+5);
+			config->pool_thread[i] = n;
+		}
+		lua_pop(L,1);
+	}
+}
+
 int sigign() {
 	struct sigaction sa;
 	sa.sa_handler = SIG_IGN;
@@ -147,9 +178,11 @@ main(int argc, char *argv[]) {
 		lua_close(L);
 		return 1;
 	}
+	_init_pool(L, &config);
 	_init_env(L);
 
 	config.thread =  optint("thread",8);
+	config.pool_thread[0] = config.thread;
 	config.module_path = optstring("cpath","./cservice/?.so");
 	config.harbor = optint("harbor", 1);
 	config.bootstrap = optstring("bootstrap","snlua bootstrap");
@@ -157,6 +190,16 @@ main(int argc, char *argv[]) {
 	config.logger = optstring("logger", NULL);
 	config.logservice = optstring("logservice", "logger");
 	config.profile = optboolean("profile", 1);
+	config.latency = optboolean("latency", 0);
+	config.worker_cpu = optstring("worker_cpu", NULL);
+	config.socket_cpu = optstring("socket_cpu", NULL);
+	config.timer_cpu = optint("timer_cpu", -1);
+	config.dispatch_budget = optint("dispatch_budget", 0);
+	config.timer_coalesce = optboolean("timer_coalesce", 0);
+	config.timer_tickless = optboolean("timer_tickless", 0);
+	config.timer_resolution = optint("timer_resolution", 10);
+	config.time_slice = optint("time_slice", 0);
+	config.socket_thread = optint("socket_thread", 1);
 
 	lua_close(L);
 
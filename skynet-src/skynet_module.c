@@ -163,11 +163,13 @@ skynet_module_instance_release(struct skynet_module *m, void *inst) {
 	}
 }
 
-void
+int
 skynet_module_instance_signal(struct skynet_module *m, void *inst, int signal) {
 	if (m->signal) {
 		m->signal(inst, signal);
+		return 1;
 	}
+	return 0;
 }
 
 void 
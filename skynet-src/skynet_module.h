@@ -22,7 +22,7 @@ struct skynet_module * skynet_module_query(const char * name);
 void * skynet_module_instance_create(struct skynet_module *);
 int skynet_module_instance_init(struct skynet_module *, void * inst, struct skynet_context *ctx, const char * parm);
 void skynet_module_instance_release(struct skynet_module *, void *inst);
-void skynet_module_instance_signal(struct skynet_module *, void *inst, int signal);
+int skynet_module_instance_signal(struct skynet_module *, void *inst, int signal);	// return 0 if the module has no signal function
 
 void skynet_module_init(const char *path);
 
@@ -4,34 +4,81 @@
 #include "skynet_server.h"
 #include "skynet.h"
 #include "atomic.h"
+#include "skynet_affinity.h"
+#include "skynet_timer.h"
 
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
+#include <time.h>
+
+#if !defined(__APPLE__)
+#define HAVE_CPUCLOCK
+#endif
 
 struct skynet_monitor {
 	int version;
 	int check_version;
+	int overrun_version;	// the version reported by skynet_monitor_slice
+	uint32_t interrupt;	// the destination signalled by skynet_monitor_slice, 0 for none
 	uint32_t source;
 	uint32_t destination;
+	uint64_t start;	// in microsec, only stamped when the time slice is on
+#ifdef HAVE_CPUCLOCK
+	clockid_t clock;	// cpu clock of the worker thread
+#endif
 };
 
+static int TIME_SLICE = 0;	// in microsec, 0 means off
+
 struct skynet_monitor * 
-skynet_monitor_new() {
-	struct skynet_monitor * ret = skynet_malloc(sizeof(*ret));
-	memset(ret, 0, sizeof(*ret));
-	return ret;
+skynet_monitor_new(int node) {
+	// the worker writes it for each message, so put it on the numa node of the worker.
+	return skynet_affinity_alloc(sizeof(struct skynet_monitor), node);
 }
 
 void 
 skynet_monitor_delete(struct skynet_monitor *sm) {
-	skynet_free(sm);
+	skynet_affinity_free(sm, sizeof(*sm));
+}
+
+// cpu time of the worker thread, or the wall clock if the platform can't read the cpu clock of other thread
+static uint64_t
+slice_time(struct skynet_monitor *sm) {
+#ifdef HAVE_CPUCLOCK
+	struct timespec ti;
+	clock_gettime(sm->clock, &ti);
+	return (uint64_t)ti.tv_sec * 1000000 + (uint64_t)ti.tv_nsec / 1000;
+#else
+	return skynet_monotonic_time();
+#endif
+}
+
+void
+skynet_monitor_bind(struct skynet_monitor *sm) {
+#ifdef HAVE_CPUCLOCK
+	if (pthread_getcpuclockid(pthread_self(), &sm->clock)) {
+		sm->clock = CLOCK_MONOTONIC;
+	}
+#endif
 }
 
 void 
 skynet_monitor_trigger(struct skynet_monitor *sm, uint32_t source, uint32_t destination) {
 	sm->source = source;
 	sm->destination = destination;
+	if (TIME_SLICE && destination) {
+		sm->start = slice_time(sm);
+	}
 	ATOM_INC(&sm->version);
+	if (TIME_SLICE) {
+		// The last message has finished (the version is changed), take back the signal of skynet_monitor_slice.
+		// It may arrive after lua-skynet checks it, and break the next message of the service.
+		uint32_t interrupt = ATOM_LOAD(&sm->interrupt);
+		if (interrupt && ATOM_CAS(&sm->interrupt, interrupt, 0)) {
+			skynet_context_signal(interrupt, SIGNAL_TIMESLICE_CANCEL);
+		}
+	}
 }
 
 void 
@@ -45,3 +92,45 @@ skynet_monitor_check(struct skynet_monitor *sm) {
 		sm->check_version = sm->version;
 	}
 }
+
+void
+skynet_monitor_timeslice(int ms) {
+	// skynet_start clamps ms to MAX_TIME_SLICE, so it doesn't overflow
+	TIME_SLICE = ms * 1000;
+}
+
+void
+skynet_monitor_slice(struct skynet_monitor *sm) {
+	int version = ATOM_LOAD(&sm->version);
+	uint32_t destination = sm->destination;
+	if (destination == 0)
+		return;
+	uint64_t cost = slice_time(sm) - sm->start;
+	if (cost <= TIME_SLICE)
+		return;
+	// Publish it before checking the version, so either skynet_monitor_trigger() sees it after the message,
+	// or the version changed is seen here after signalling.
+	uint32_t last;
+	do {
+		last = sm->interrupt;
+	} while (!ATOM_CAS(&sm->interrupt, last, destination));
+	if (version != ATOM_LOAD(&sm->version)) {
+		ATOM_CAS(&sm->interrupt, destination, 0);
+		return;
+	}
+	// signal again until it stops, the signal of lua is one slot shared by all services.
+	int interrupt = skynet_context_signal(destination, SIGNAL_TIMESLICE);
+	// skynet_context_signal() releases the context by an atomic operation, which is a full barrier after the signal.
+	if (version != ATOM_LOAD(&sm->version)) {
+		// the message has finished meanwhile, skynet_monitor_trigger() may take the interrupt before the signal arrives
+		ATOM_CAS(&sm->interrupt, destination, 0);
+		skynet_context_signal(destination, SIGNAL_TIMESLICE_CANCEL);
+		return;
+	}
+	if (sm->overrun_version != version) {
+		sm->overrun_version = version;
+		skynet_context_overrun(destination);
+		skynet_error(NULL, "A message from [ :%08x ] to [ :%08x ] exceeds the time slice (%d ms)%s", sm->source, destination, (int)(cost / 1000),
+			interrupt ? ", interrupt it" : "");
+	}
+}
@@ -5,9 +5,17 @@
 
 struct skynet_monitor;
 
-struct skynet_monitor * skynet_monitor_new();
+struct skynet_monitor * skynet_monitor_new(int node);	// node < 0 means any numa node
 void skynet_monitor_delete(struct skynet_monitor *);
 void skynet_monitor_trigger(struct skynet_monitor *, uint32_t source, uint32_t destination);
 void skynet_monitor_check(struct skynet_monitor *);
 
+// time slice of a message in millisecond, 0 means off.
+// skynet_monitor_slice() interrupts the service (SIGNAL_TIMESLICE) which runs a message longer than it.
+// It can't be longer than MAX_TIME_SLICE, the period of the endless loop check.
+#define MAX_TIME_SLICE 5000
+void skynet_monitor_timeslice(int ms);
+void skynet_monitor_slice(struct skynet_monitor *);
+void skynet_monitor_bind(struct skynet_monitor *);	// called by the worker thread, the time slice is measured in its cpu time
+
 #endif
@@ -2,7 +2,13 @@
 #include "skynet_mq.h"
 #include "skynet_handle.h"
 #include "spinlock.h"
+#include "atomic.h"
+#include "parking.h"
+#include "skynet_affinity.h"
+#include "skynet_schedtrace.h"
 
+#include <pthread.h>
+#include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -11,6 +17,9 @@
 
 #define DEFAULT_QUEUE_SIZE 64
 #define MAX_GLOBAL_MQ 0x10000
+#define GLOBAL_CHECK_INTERVAL 61
+#define SPIN_MIN 16
+#define SPIN_MAX 1024
 
 // 0 means mq is not in global mq.
 // 1 means mq is in global mq , or the message is dispatching.
@@ -18,6 +27,8 @@
 #define MQ_IN_GLOBAL 1
 #define MQ_OVERLOAD 1024
 
+#ifndef USE_LOCKFREE_MQ
+
 struct message_queue {
 	struct spinlock lock;
 	uint32_t handle;
@@ -28,56 +39,423 @@ struct message_queue {
 	int in_global;
 	int overload;
 	int overload_threshold;
+	int pool;
 	struct skynet_message *queue;
 	struct message_queue *next;
 };
 
+#else
+
+// A lock-free multi-producer/single-consumer queue.
+// Each segment is a bounded ring (slot.seq tells whether a slot is writable or readable).
+// When a segment is full, the producer closes it (SEGMENT_CLOSED bit in tail) and links a
+// new segment of double size. Producers may still hold an old segment, so the segments are
+// kept until the queue is released, just like expand_queue never shrinks the queue.
+
+#define SEGMENT_CLOSED ((uint64_t)1 << 63)
+
+struct mq_slot {
+	uint64_t seq;
+	struct skynet_message message;
+};
+
+struct mq_segment {
+	struct mq_segment *next;
+	uint64_t tail;
+	int cap;
+	struct mq_slot slot[1];
+};
+
+struct message_queue {
+	uint32_t handle;
+	int release;
+	int in_global;
+	int overload;
+	int overload_threshold;
+	int pool;
+	uint64_t head;	// only the consumer (the worker owns the queue) touches head and head_seg
+	struct mq_segment *head_seg;
+	struct mq_segment *tail_seg;
+	struct mq_segment *first;
+	struct message_queue *next;
+};
+
+#endif
+
 struct global_queue {
 	struct message_queue *head;
 	struct message_queue *tail;
 	struct spinlock lock;
 };
 
-static struct global_queue *Q = NULL;
+// Each worker owns a local run queue. skynet_globalmq_push from a worker thread
+// goes to its local queue, other threads (socket, timer, main) use the shared one.
+// An idle worker takes from the shared queue first, and then steals half of a busy peer's queue.
+// If there is nothing to do, it spins for a while (adaptive), and then parks on its own parking slot.
+// Pushing a queue wakes exactly one parked worker, if no worker is spinning.
+// The workers are divided into pools, each pool has its own shared queue and workers,
+// a message queue only runs on the workers of its pool, so pools never steal from each other.
 
-void 
-skynet_globalmq_push(struct message_queue * queue) {
-	struct global_queue *q= Q;
+struct worker_pool;
 
-	SPIN_LOCK(q)
+struct local_queue {
+	struct message_queue *head;
+	struct message_queue *tail;
+	struct spinlock lock;
+	int length;
+	int id;
+	unsigned tick;
+	int spin;
+	struct worker_pool *pool;
+	struct parking park;
+} __attribute__ ((aligned (64)));
+
+struct worker_pool {
+	struct global_queue global;
+	char * name;
+	int worker;
+	int spinner;	// max number of spinning workers
+	int spinning;
+	int sleeping;
+	struct local_queue **local;
+};
+
+struct run_queue {
+	int worker;
+	int pools;
+	int quit;
+	struct worker_pool *pool;
+	struct local_queue **local;
+	pthread_key_t local_key;
+};
+
+static struct run_queue *Q = NULL;
+
+static inline void
+queue_append(struct message_queue **head, struct message_queue **tail, struct message_queue *queue) {
 	assert(queue->next == NULL);
-	if(q->tail) {
-		q->tail->next = queue;
-		q->tail = queue;
+	if(*tail) {
+		(*tail)->next = queue;
+		*tail = queue;
 	} else {
-		q->head = q->tail = queue;
+		*head = *tail = queue;
 	}
-	SPIN_UNLOCK(q)
 }
 
-struct message_queue * 
-skynet_globalmq_pop() {
-	struct global_queue *q = Q;
-
-	SPIN_LOCK(q)
-	struct message_queue *mq = q->head;
+static inline struct message_queue *
+queue_take(struct message_queue **head, struct message_queue **tail) {
+	struct message_queue *mq = *head;
 	if(mq) {
-		q->head = mq->next;
-		if(q->head == NULL) {
-			assert(mq == q->tail);
-			q->tail = NULL;
+		*head = mq->next;
+		if(*head == NULL) {
+			assert(mq == *tail);
+			*tail = NULL;
 		}
 		mq->next = NULL;
 	}
+	return mq;
+}
+
+static void
+shared_push(struct global_queue *q, struct message_queue * queue) {
+	SPIN_LOCK(q)
+	queue_append(&q->head, &q->tail, queue);
+	SPIN_UNLOCK(q)
+}
+
+static struct message_queue *
+shared_pop(struct global_queue *q) {
+	if (q->head == NULL) {
+		// check it without lock first, the global queue is usually empty.
+		return NULL;
+	}
+	SPIN_LOCK(q)
+	struct message_queue *mq = queue_take(&q->head, &q->tail);
 	SPIN_UNLOCK(q)
 
 	return mq;
 }
 
+static void
+local_push(struct local_queue *lq, struct message_queue * queue) {
+	SPIN_LOCK(lq)
+	queue_append(&lq->head, &lq->tail, queue);
+	++lq->length;
+	SPIN_UNLOCK(lq)
+}
+
+static struct message_queue *
+local_pop(struct local_queue *lq) {
+	if (lq->length == 0)
+		return NULL;
+	SPIN_LOCK(lq)
+	struct message_queue *mq = queue_take(&lq->head, &lq->tail);
+	if (mq) {
+		--lq->length;
+	}
+	SPIN_UNLOCK(lq)
+
+	return mq;
+}
+
+// steal half of the queues from victim, return the first one and put the others into lq
+static struct message_queue *
+local_steal(struct local_queue *lq, struct local_queue *victim) {
+	if (victim->length == 0)
+		return NULL;
+	struct message_queue *head = NULL;
+	struct message_queue *tail = NULL;
+	int n = 0;
+	SPIN_LOCK(victim)
+	int half = (victim->length + 1) / 2;
+	while (n < half) {
+		struct message_queue *mq = queue_take(&victim->head, &victim->tail);
+		if (mq == NULL)
+			break;
+		queue_append(&head, &tail, mq);
+		++n;
+	}
+	victim->length -= n;
+	SPIN_UNLOCK(victim)
+
+	struct message_queue *mq = queue_take(&head, &tail);
+	if (head) {
+		SPIN_LOCK(lq)
+		if (lq->tail) {
+			lq->tail->next = head;
+			lq->tail = tail;
+		} else {
+			lq->head = head;
+			lq->tail = tail;
+		}
+		lq->length += n - 1;
+		SPIN_UNLOCK(lq)
+	}
+	return mq;
+}
+
+static inline struct local_queue *
+current_local() {
+	return pthread_getspecific(Q->local_key);
+}
+
+static void
+wakeup_one(struct worker_pool *p) {
+	if (p->sleeping == 0 || p->spinning > 0) {
+		// The spinning worker will find the queue
+		return;
+	}
+	int i;
+	for (i=0;i<p->worker;i++) {
+		struct local_queue *lq = p->local[i];
+		if (lq->park.state == 1 && ATOM_CAS(&lq->park.state, 1, 0)) {
+			ATOM_DEC(&p->sleeping);
+			skynet_schedtrace(SCHEDTRACE_WAKEUP, SCHEDTRACE_INSTANT, lq->id);
+			parking_wake(&lq->park);
+			return;
+		}
+	}
+}
+
+void 
+skynet_globalmq_push(struct message_queue * queue) {
+	struct worker_pool *p = &Q->pool[queue->pool];
+	struct local_queue *lq = current_local();
+	if (lq && lq->pool == p) {
+		local_push(lq, queue);
+	} else {
+		shared_push(&p->global, queue);
+	}
+	// pair with the ATOM_INC(&p->sleeping) in skynet_globalmq_wait
+	__sync_synchronize();
+	wakeup_one(p);
+}
+
+struct message_queue * 
+skynet_globalmq_pop(int steal) {
+	struct local_queue *lq = current_local();
+	if (lq == NULL) {
+		return shared_pop(&Q->pool[0].global);
+	}
+	struct worker_pool *p = lq->pool;
+	struct message_queue *mq;
+	// check the shared queue first sometimes, so it can't be starved by a busy local queue.
+	if ((++lq->tick % GLOBAL_CHECK_INTERVAL) == 0) {
+		mq = shared_pop(&p->global);
+		if (mq)
+			return mq;
+	}
+	mq = local_pop(lq);
+	if (mq)
+		return mq;
+	mq = shared_pop(&p->global);
+	if (mq || !steal)
+		return mq;
+	int i;
+	for (i=1;i<p->worker;i++) {
+		struct local_queue *victim = p->local[(lq->id + i) % p->worker];
+		mq = local_steal(lq, victim);
+		if (mq)
+			return mq;
+	}
+	return NULL;
+}
+
+struct message_queue *
+skynet_globalmq_wait(void) {
+	struct run_queue *rq = Q;
+	struct local_queue *lq = current_local();
+	assert(lq);
+	struct worker_pool *p = lq->pool;
+	struct message_queue *mq = NULL;
+	if (p->spinning < p->spinner) {
+		ATOM_INC(&p->spinning);
+		int i;
+		for (i=0;i<lq->spin;i++) {
+			mq = skynet_globalmq_pop(1);
+			if (mq)
+				break;
+			cpu_relax();
+		}
+		if (ATOM_DEC(&p->spinning) == 0 && mq) {
+			// The last spinning worker found a queue, there may be more.
+			wakeup_one(p);
+		}
+		if (mq) {
+			if (lq->spin < SPIN_MAX)
+				lq->spin *= 2;
+			return mq;
+		}
+		if (lq->spin > SPIN_MIN)
+			lq->spin /= 2;
+	}
+
+	lq->park.state = 1;
+	ATOM_INC(&p->sleeping);
+	// check again after set the state, because skynet_globalmq_push may not see it.
+	if (!rq->quit) {
+		mq = skynet_globalmq_pop(1);
+	}
+	if (mq || rq->quit) {
+		if (ATOM_CAS(&lq->park.state, 1, 0)) {
+			ATOM_DEC(&p->sleeping);
+		}
+		return mq;
+	}
+	parking_wait(&lq->park);
+
+	return NULL;
+}
+
+void
+skynet_globalmq_exit(void) {
+	struct run_queue *rq = Q;
+	rq->quit = 1;
+	__sync_synchronize();
+	int i;
+	for (i=0;i<rq->worker;i++) {
+		struct local_queue *lq = rq->local[i];
+		if (ATOM_CAS(&lq->park.state, 1, 0)) {
+			ATOM_DEC(&lq->pool->sleeping);
+			parking_wake(&lq->park);
+		}
+	}
+}
+
+void
+skynet_globalmq_bind(int worker) {
+	struct run_queue *rq = Q;
+	assert(worker >= 0 && worker < rq->worker);
+	pthread_setspecific(rq->local_key, rq->local[worker]);
+}
+
+uint32_t 
+skynet_mq_handle(struct message_queue *q) {
+	return q->handle;
+}
+
+int
+skynet_mq_overload(struct message_queue *q) {
+	if (q->overload) {
+		int overload = q->overload;
+		q->overload = 0;
+		return overload;
+	} 
+	return 0;
+}
+
+static inline int
+batch_size(int length, int n, int weight) {
+	if (weight < 0) {
+		return 1;
+	}
+	int m = length >> weight;
+	if (m < n) {
+		n = m;
+	}
+	return n > 1 ? n : 1;
+}
+
+int
+skynet_mq_pool(const char * name) {
+	int i;
+	for (i=0;i<Q->pools;i++) {
+		if (strcmp(Q->pool[i].name, name) == 0)
+			return i;
+	}
+	return -1;
+}
+
+void 
+skynet_mq_init(int pools, const char * name[], const int thread[], const int *node) {
+	struct run_queue *q = skynet_malloc(sizeof(*q));
+	memset(q,0,sizeof(*q));
+	int worker = 0;
+	int i,j;
+	for (i=0;i<pools;i++) {
+		worker += thread[i];
+	}
+	q->worker = worker;
+	q->pools = pools;
+	q->pool = skynet_malloc(pools * sizeof(struct worker_pool));
+	memset(q->pool, 0, pools * sizeof(struct worker_pool));
+	q->local = skynet_malloc(worker * sizeof(struct local_queue *));
+	int ncpu = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	int first = 0;
+	for (i=0;i<pools;i++) {
+		struct worker_pool *p = &q->pool[i];
+		SPIN_INIT(&p->global);
+		p->name = skynet_strdup(name[i]);
+		p->worker = thread[i];
+		// No more than half of the workers (or cpus) spin, so don't spin on a single cpu.
+		p->spinner = (ncpu > 0 && ncpu < p->worker ? ncpu : p->worker) / 2;
+		p->local = q->local + first;
+		for (j=0;j<p->worker;j++) {
+			// The local queue is hot for the worker, allocate it on the numa node of the worker.
+			struct local_queue *lq = skynet_affinity_alloc(sizeof(struct local_queue), node ? node[first + j] : -1);
+			SPIN_INIT(lq);
+			lq->id = j;
+			lq->spin = SPIN_MIN;
+			lq->pool = p;
+			parking_init(&lq->park);
+			p->local[j] = lq;
+		}
+		first += p->worker;
+	}
+	if (pthread_key_create(&q->local_key, NULL)) {
+		fprintf(stderr, "pthread_key_create failed");
+		exit(1);
+	}
+	Q=q;
+}
+
+#ifndef USE_LOCKFREE_MQ
+
 struct message_queue * 
-skynet_mq_create(uint32_t handle) {
+skynet_mq_create(uint32_t handle, int pool) {
 	struct message_queue *q = skynet_malloc(sizeof(*q));
 	q->handle = handle;
+	q->pool = pool;
 	q->cap = DEFAULT_QUEUE_SIZE;
 	q->head = 0;
 	q->tail = 0;
@@ -103,11 +481,6 @@ _release(struct message_queue *q) {
 	skynet_free(q);
 }
 
-uint32_t 
-skynet_mq_handle(struct message_queue *q) {
-	return q->handle;
-}
-
 int
 skynet_mq_length(struct message_queue *q) {
 	int head, tail,cap;
@@ -124,16 +497,6 @@ skynet_mq_length(struct message_queue *q) {
 	return tail + cap - head;
 }
 
-int
-skynet_mq_overload(struct message_queue *q) {
-	if (q->overload) {
-		int overload = q->overload;
-		q->overload = 0;
-		return overload;
-	} 
-	return 0;
-}
-
 int
 skynet_mq_pop(struct message_queue *q, struct skynet_message *message) {
 	int ret = 1;
@@ -171,6 +534,44 @@ skynet_mq_pop(struct message_queue *q, struct skynet_message *message) {
 	return ret;
 }
 
+int
+skynet_mq_pop_batch(struct message_queue *q, struct skynet_message *buffer, int n, int weight) {
+	SPIN_LOCK(q)
+
+	int head = q->head;
+	int tail = q->tail;
+	int cap = q->cap;
+	int length = tail - head;
+	if (length < 0) {
+		length += cap;
+	}
+	if (length == 0) {
+		// reset overload_threshold when queue is empty
+		q->overload_threshold = MQ_OVERLOAD;
+		q->in_global = 0;
+		SPIN_UNLOCK(q)
+		return 0;
+	}
+	n = batch_size(length, n, weight);
+	int i;
+	for (i=0;i<n;i++) {
+		buffer[i] = q->queue[head];
+		if (++head >= cap) {
+			head = 0;
+		}
+	}
+	q->head = head;
+	length -= n;
+	while (length > q->overload_threshold) {
+		q->overload = length;
+		q->overload_threshold *= 2;
+	}
+
+	SPIN_UNLOCK(q)
+
+	return n;
+}
+
 static void
 expand_queue(struct message_queue *q) {
 	struct skynet_message *new_queue = skynet_malloc(sizeof(struct skynet_message) * q->cap * 2);
@@ -200,33 +601,210 @@ skynet_mq_push(struct message_queue *q, struct skynet_message *message) {
 		expand_queue(q);
 	}
 
+	int ready = 0;
 	if (q->in_global == 0) {
 		q->in_global = MQ_IN_GLOBAL;
-		skynet_globalmq_push(q);
+		ready = 1;
 	}
 	
 	SPIN_UNLOCK(q)
+
+	// push it out of the lock, because skynet_globalmq_push may wake up a worker.
+	if (ready) {
+		skynet_globalmq_push(q);
+	}
 }
 
 void 
-skynet_mq_init() {
-	struct global_queue *q = skynet_malloc(sizeof(*q));
-	memset(q,0,sizeof(*q));
-	SPIN_INIT(q);
-	Q=q;
+skynet_mq_mark_release(struct message_queue *q) {
+	SPIN_LOCK(q)
+	assert(q->release == 0);
+	q->release = 1;
+	int ready = q->in_global != MQ_IN_GLOBAL;
+	SPIN_UNLOCK(q)
+
+	if (ready) {
+		skynet_globalmq_push(q);
+	}
+}
+
+#else
+
+static struct mq_segment *
+new_segment(int cap) {
+	struct mq_segment *seg = skynet_malloc(sizeof(*seg) + sizeof(struct mq_slot) * (cap - 1));
+	seg->next = NULL;
+	seg->tail = 0;
+	seg->cap = cap;
+	int i;
+	for (i=0;i<cap;i++) {
+		seg->slot[i].seq = i;
+	}
+	return seg;
+}
+
+// seg is closed, return the next segment (create it if nobody did)
+static struct mq_segment *
+next_segment(struct message_queue *q, struct mq_segment *seg) {
+	struct mq_segment *next = ATOM_LOAD(&seg->next);
+	if (next == NULL) {
+		struct mq_segment *ns = new_segment(seg->cap * 2);
+		if (ATOM_CAS_POINTER(&seg->next, NULL, ns)) {
+			next = ns;
+		} else {
+			skynet_free(ns);
+			next = ATOM_LOAD(&seg->next);
+		}
+	}
+	ATOM_CAS_POINTER(&q->tail_seg, seg, next);
+	return next;
+}
+
+struct message_queue * 
+skynet_mq_create(uint32_t handle, int pool) {
+	struct message_queue *q = skynet_malloc(sizeof(*q));
+	q->handle = handle;
+	q->pool = pool;
+	// See the comment in the lock version
+	q->in_global = MQ_IN_GLOBAL;
+	q->release = 0;
+	q->overload = 0;
+	q->overload_threshold = MQ_OVERLOAD;
+	q->head = 0;
+	q->first = q->head_seg = q->tail_seg = new_segment(DEFAULT_QUEUE_SIZE);
+	q->next = NULL;
+
+	return q;
+}
+
+static void 
+_release(struct message_queue *q) {
+	assert(q->next == NULL);
+	struct mq_segment *seg = q->first;
+	while (seg) {
+		struct mq_segment *next = seg->next;
+		skynet_free(seg);
+		seg = next;
+	}
+	skynet_free(q);
+}
+
+static int
+queue_length(struct message_queue *q) {
+	struct mq_segment *seg = q->head_seg;
+	uint64_t head = q->head;
+	int length = 0;
+	while (seg) {
+		length += (int)((ATOM_LOAD(&seg->tail) & ~SEGMENT_CLOSED) - head);
+		head = 0;
+		seg = ATOM_LOAD(&seg->next);
+	}
+	return length;
+}
+
+int
+skynet_mq_length(struct message_queue *q) {
+	int length = queue_length(q);
+	return length < 0 ? 0 : length;
+}
+
+static inline int
+queue_empty(struct message_queue *q) {
+	return ATOM_LOAD(&q->head_seg->tail) == q->head;
+}
+
+int
+skynet_mq_pop(struct message_queue *q, struct skynet_message *message) {
+	for (;;) {
+		struct mq_segment *seg = q->head_seg;
+		uint64_t pos = q->head;
+		struct mq_slot *slot = &seg->slot[pos & (seg->cap - 1)];
+		if (ATOM_LOAD(&slot->seq) == pos + 1) {
+			*message = slot->message;
+			q->head = pos + 1;
+			// make the slot writable for the producer of (pos + cap)
+			ATOM_STORE(&slot->seq, pos + seg->cap);
+			int length = queue_length(q);
+			while (length > q->overload_threshold) {
+				q->overload = length;
+				q->overload_threshold *= 2;
+			}
+			return 0;
+		}
+		uint64_t tail = ATOM_LOAD(&seg->tail);
+		if ((tail & ~SEGMENT_CLOSED) != pos) {
+			// A producer has taken the slot, but not finished writing yet.
+			continue;
+		}
+		if (tail & SEGMENT_CLOSED) {
+			q->head_seg = next_segment(q, seg);
+			q->head = 0;
+			continue;
+		}
+		// reset overload_threshold when queue is empty
+		q->overload_threshold = MQ_OVERLOAD;
+		q->in_global = 0;
+		__sync_synchronize();
+		// A producer may push a message before it see in_global == 0, take the queue back.
+		if (queue_empty(q) || !ATOM_CAS(&q->in_global, 0, MQ_IN_GLOBAL)) {
+			return 1;
+		}
+	}
+}
+
+int
+skynet_mq_pop_batch(struct message_queue *q, struct skynet_message *buffer, int n, int weight) {
+	// only the consumer pops, so the messages counted by queue_length are always there (or being written).
+	n = batch_size(queue_length(q), n, weight);
+	int i;
+	for (i=0;i<n;i++) {
+		if (skynet_mq_pop(q, &buffer[i]))
+			break;
+	}
+	return i;
+}
+
+void 
+skynet_mq_push(struct message_queue *q, struct skynet_message *message) {
+	assert(message);
+	struct mq_segment *seg = ATOM_LOAD(&q->tail_seg);
+	for (;;) {
+		uint64_t pos = ATOM_LOAD(&seg->tail);
+		if (pos & SEGMENT_CLOSED) {
+			seg = next_segment(q, seg);
+			continue;
+		}
+		struct mq_slot *slot = &seg->slot[pos & (seg->cap - 1)];
+		int64_t dif = (int64_t)(ATOM_LOAD(&slot->seq) - pos);
+		if (dif == 0) {
+			if (ATOM_CAS(&seg->tail, pos, pos + 1)) {
+				slot->message = *message;
+				ATOM_STORE(&slot->seq, pos + 1);
+				break;
+			}
+		} else if (dif < 0) {
+			// The segment is full, close it and move to a larger one.
+			ATOM_CAS(&seg->tail, pos, pos | SEGMENT_CLOSED);
+		}
+	}
+
+	if (q->in_global == 0 && ATOM_CAS(&q->in_global, 0, MQ_IN_GLOBAL)) {
+		skynet_globalmq_push(q);
+	}
 }
 
 void 
 skynet_mq_mark_release(struct message_queue *q) {
-	SPIN_LOCK(q)
 	assert(q->release == 0);
 	q->release = 1;
-	if (q->in_global != MQ_IN_GLOBAL) {
+	__sync_synchronize();
+	if (ATOM_CAS(&q->in_global, 0, MQ_IN_GLOBAL)) {
 		skynet_globalmq_push(q);
 	}
-	SPIN_UNLOCK(q)
 }
 
+#endif
+
 static void
 _drop_queue(struct message_queue *q, message_drop drop_func, void *ud) {
 	struct skynet_message msg;
@@ -236,6 +814,8 @@ _drop_queue(struct message_queue *q, message_drop drop_func, void *ud) {
 	_release(q);
 }
 
+#ifndef USE_LOCKFREE_MQ
+
 void 
 skynet_mq_release(struct message_queue *q, message_drop drop_func, void *ud) {
 	SPIN_LOCK(q)
@@ -244,7 +824,21 @@ skynet_mq_release(struct message_queue *q, message_drop drop_func, void *ud) {
 		SPIN_UNLOCK(q)
 		_drop_queue(q, drop_func, ud);
 	} else {
-		skynet_globalmq_push(q);
 		SPIN_UNLOCK(q)
+		skynet_globalmq_push(q);
+	}
+}
+
+#else
+
+void 
+skynet_mq_release(struct message_queue *q, message_drop drop_func, void *ud) {
+	__sync_synchronize();
+	if (q->release) {
+		_drop_queue(q, drop_func, ud);
+	} else {
+		skynet_globalmq_push(q);
 	}
 }
+
+#endif
@@ -9,18 +9,29 @@ struct skynet_message {
 	int session;
 	void * data;
 	size_t sz;
+	uint64_t stamp;	// push time in microsec when the latency stat of the service is on, or 0
 };
 
 // type is encoding in skynet_message.sz high 8bit
-#define MESSAGE_TYPE_MASK (SIZE_MAX >> 8)
+// and the next bit marks a shared payload (see skynet_send_multi)
+#define MESSAGE_TYPE_MASK (SIZE_MAX >> 9)
 #define MESSAGE_TYPE_SHIFT ((sizeof(size_t)-1) * 8)
+#define MESSAGE_SHARED ((size_t)1 << (MESSAGE_TYPE_SHIFT - 1))
 
 struct message_queue;
 
+// push to the local queue of current worker thread, or the shared queue of the queue's pool for other threads
 void skynet_globalmq_push(struct message_queue * queue);
-struct message_queue * skynet_globalmq_pop(void);
-
-struct message_queue * skynet_mq_create(uint32_t handle);
+// pop from local queue and then the global queue, steal from other workers if steal is not 0
+struct message_queue * skynet_globalmq_pop(int steal);
+// bind current thread to the local queue of worker
+void skynet_globalmq_bind(int worker);
+// for idle worker : spin and then park, return a queue or NULL (woken up)
+struct message_queue * skynet_globalmq_wait(void);
+// wake up all the parked workers, and they never park again
+void skynet_globalmq_exit(void);
+
+struct message_queue * skynet_mq_create(uint32_t handle, int pool);
 void skynet_mq_mark_release(struct message_queue *q);
 
 typedef void (*message_drop)(struct skynet_message *, void *);
@@ -31,11 +42,18 @@ uint32_t skynet_mq_handle(struct message_queue *);
 // 0 for success
 int skynet_mq_pop(struct message_queue *q, struct skynet_message *message);
 void skynet_mq_push(struct message_queue *q, struct skynet_message *message);
+// pop messages into buffer (no more than n) at once, return the number of messages, 0 means the queue is empty.
+// weight < 0 : pop only one message, weight >= 0 : pop (length >> weight) messages, at least one.
+int skynet_mq_pop_batch(struct message_queue *q, struct skynet_message *buffer, int n, int weight);
 
 // return the length of message queue, for debug
 int skynet_mq_length(struct message_queue *q);
 int skynet_mq_overload(struct message_queue *q);
 
-void skynet_mq_init();
+// pools of workers : name and number of threads of each pool, pool 0 is the default one.
+// node is the numa node of each worker (in pool order), can be NULL
+void skynet_mq_init(int pools, const char * name[], const int thread[], const int *node);
+// return the pool id of name, -1 if not found
+int skynet_mq_pool(const char * name);
 
 #endif
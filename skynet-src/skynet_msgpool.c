@@ -0,0 +1,162 @@
+#include "skynet.h"
+#include "skynet_msgpool.h"
+#include "malloc_hook.h"
+#include "atomic.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MSGPOOL_CLASS 6	// 16, 32, 64, 128, 256, 512 bytes
+#define MSGPOOL_MIN 16
+#define MSGPOOL_MAX (MSGPOOL_MIN << (MSGPOOL_CLASS - 1))
+#define MSGPOOL_CACHE 256	// max buffers of each class in a pool
+#define MSGPOOL_SPILL 1024	// max buffers of each class in the spill stack
+
+struct freenode {
+	struct freenode *next;
+};
+
+struct msgpool {
+	struct freenode *list[MSGPOOL_CLASS];
+	int n[MSGPOOL_CLASS];
+};
+
+// The buffers freed by a thread whose pool is full (or without pool), for the threads allocate more than free.
+// eg. the socket threads allocate the buffers of received data, and the workers free them.
+// Pushed one by one and taken all at once, so the lock-free stack has no ABA problem.
+struct spill {
+	struct freenode *head;
+	int n;
+};
+
+static pthread_key_t POOL_KEY;
+static struct spill SPILL[MSGPOOL_CLASS];
+
+static int
+spill_push(int c, struct freenode *node) {
+	struct spill *s = &SPILL[c];
+	if (ATOM_INC(&s->n) > MSGPOOL_SPILL) {
+		ATOM_DEC(&s->n);
+		return 0;
+	}
+	for (;;) {
+		struct freenode *head = s->head;
+		node->next = head;
+		if (ATOM_CAS_POINTER(&s->head, head, node))
+			return 1;
+	}
+}
+
+static void
+spill_take(struct msgpool *p, int c) {
+	struct spill *s = &SPILL[c];
+	struct freenode *head;
+	do {
+		head = s->head;
+		if (head == NULL)
+			return;
+	} while (!ATOM_CAS_POINTER(&s->head, head, NULL));
+	int n = 0;
+	struct freenode *node;
+	for (node = head; node; node = node->next) {
+		++n;
+	}
+	ATOM_SUB(&s->n, n);
+	p->list[c] = head;
+	p->n[c] = n;
+}
+
+static void
+pool_delete(void *ud) {
+	struct msgpool *p = ud;
+	int i;
+	for (i=0;i<MSGPOOL_CLASS;i++) {
+		struct freenode *node = p->list[i];
+		while (node) {
+			struct freenode *next = node->next;
+			skynet_free(node);
+			node = next;
+		}
+	}
+	skynet_free(p);
+}
+
+void
+skynet_msgpool_init(void) {
+	if (pthread_key_create(&POOL_KEY, pool_delete)) {
+		fprintf(stderr, "pthread_key_create failed");
+		exit(1);
+	}
+}
+
+void
+skynet_msgpool_thread(void) {
+	struct msgpool *p = skynet_malloc(sizeof(*p));
+	memset(p, 0, sizeof(*p));
+	pthread_setspecific(POOL_KEY, p);
+}
+
+void *
+skynet_msgpool_alloc(size_t sz) {
+	if (sz > MSGPOOL_MAX) {
+		return skynet_malloc(sz);
+	}
+	// the smallest class can hold sz
+	int c = 0;
+	while ((MSGPOOL_MIN << c) < sz) {
+		++c;
+	}
+	struct msgpool *p = pthread_getspecific(POOL_KEY);
+	if (p && p->list[c] == NULL) {
+		spill_take(p, c);
+	}
+	if (p && p->list[c]) {
+		struct freenode *node = p->list[c];
+		p->list[c] = node->next;
+		--p->n[c];
+		malloc_rehandle(node, skynet_current_handle());
+		return node;
+	}
+	// allocate the whole class size, so it can go back to the same class
+	return skynet_malloc(MSGPOOL_MIN << c);
+}
+
+void
+skynet_msgpool_free(void *ptr) {
+	if (ptr == NULL)
+		return;
+	// The sender may allocate the buffer by itself (PTYPE_TAG_DONTCOPY), so use the real size.
+	size_t sz = malloc_usable(ptr);
+	if (sz >= MSGPOOL_MIN && sz < MSGPOOL_MAX * 2) {
+		// the largest class fits in the buffer
+		int c = MSGPOOL_CLASS - 1;
+		while ((MSGPOOL_MIN << c) > sz) {
+			--c;
+		}
+		// the pooled buffers belong to no service until they are handed out again
+		malloc_rehandle(ptr, 0);
+		struct msgpool *p = pthread_getspecific(POOL_KEY);
+		if (p && p->n[c] < MSGPOOL_CACHE) {
+			struct freenode *node = ptr;
+			node->next = p->list[c];
+			p->list[c] = node;
+			++p->n[c];
+			return;
+		}
+		if (spill_push(c, ptr))
+			return;
+	}
+	skynet_free(ptr);
+}
+
+void *
+skynet_message_alloc(size_t sz) {
+	return skynet_msgpool_alloc(sz);
+}
+
+void
+skynet_message_free(void *ptr) {
+	skynet_msgpool_free(ptr);
+}
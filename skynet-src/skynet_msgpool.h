@@ -0,0 +1,17 @@
+#ifndef SKYNET_MSGPOOL_H
+#define SKYNET_MSGPOOL_H
+
+#include <stddef.h>
+
+// Each worker thread keeps the small message buffers it frees, and reuses them for the messages it sends.
+// The buffers are ordinary blocks of skynet_malloc, so skynet_free is always safe for them.
+// A pooled buffer is charged to handle 0 in the memory stats, and to the allocating service when it's reused.
+// The overflow of a pool is shared by other threads (the socket threads allocate much more than they free).
+
+void skynet_msgpool_init(void);
+// create the pool of current (worker or socket) thread
+void skynet_msgpool_thread(void);
+void * skynet_msgpool_alloc(size_t sz);
+void skynet_msgpool_free(void *ptr);
+
+#endif
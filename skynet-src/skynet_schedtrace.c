@@ -0,0 +1,156 @@
+#include "skynet.h"
+#include "skynet_schedtrace.h"
+#include "skynet_timer.h"
+#include "atomic.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_TRACE_THREAD 256
+#define TRACE_RING 0x10000	// events per thread, must be power of 2
+
+struct trace_event {
+	uint64_t ts;	// in microsec
+	uint32_t arg;
+	uint8_t type;
+	uint8_t phase;
+};
+
+struct trace_thread {
+	char name[32];
+	uint64_t head;	// number of events recorded, only the owner thread writes it
+	struct trace_event *ring;	// allocated at the first event
+};
+
+struct schedtrace {
+	int n;
+	uint64_t since;	// the time of turning on, older events are not dumped
+	pthread_key_t key;
+	struct trace_thread *thread[MAX_TRACE_THREAD];
+};
+
+static struct schedtrace *T = NULL;
+
+volatile int skynet_schedtrace_on = 0;
+
+void
+skynet_schedtrace_init(void) {
+	struct schedtrace *t = skynet_malloc(sizeof(*t));
+	memset(t, 0, sizeof(*t));
+	if (pthread_key_create(&t->key, NULL)) {
+		fprintf(stderr, "pthread_key_create failed");
+		exit(1);
+	}
+	T = t;
+}
+
+void
+skynet_schedtrace_thread(const char *name, int id) {
+	int n = ATOM_FINC(&T->n);
+	if (n >= MAX_TRACE_THREAD) {
+		ATOM_DEC(&T->n);
+		return;
+	}
+	struct trace_thread *t = skynet_malloc(sizeof(*t));
+	memset(t, 0, sizeof(*t));
+	snprintf(t->name, sizeof(t->name), "%s %d", name, id);
+	pthread_setspecific(T->key, t);
+	ATOM_STORE(&T->thread[n], t);
+}
+
+void
+skynet_schedtrace_enable(int on) {
+	if (on && !skynet_schedtrace_on) {
+		T->since = skynet_monotonic_time();
+	}
+	skynet_schedtrace_on = on;
+}
+
+void
+skynet_schedtrace_record(int type, int phase, uint32_t arg) {
+	struct trace_thread *t = pthread_getspecific(T->key);
+	if (t == NULL)
+		return;
+	if (t->ring == NULL) {
+		struct trace_event *ring = skynet_malloc(TRACE_RING * sizeof(struct trace_event));
+		ATOM_STORE(&t->ring, ring);
+	}
+	struct trace_event *e = &t->ring[t->head & (TRACE_RING - 1)];
+	e->ts = skynet_monotonic_time();
+	e->arg = arg;
+	e->type = (uint8_t)type;
+	e->phase = (uint8_t)phase;
+	ATOM_STORE(&t->head, t->head + 1);
+}
+
+static void
+dump_event(FILE *f, int tid, struct trace_event *e) {
+	const char * name;
+	char args[64];
+	args[0] = '\0';
+	switch (e->type) {
+	case SCHEDTRACE_DISPATCH:
+		name = "dispatch";
+		if (e->phase == SCHEDTRACE_BEGIN) {
+			sprintf(args, "\"handle\":\":%08x\"", e->arg);
+		} else {
+			sprintf(args, "\"message\":%u", e->arg);
+		}
+		break;
+	case SCHEDTRACE_WAIT:
+		name = "wait";
+		break;
+	case SCHEDTRACE_WAKEUP:
+		name = "wakeup";
+		sprintf(args, "\"worker\":%u", e->arg);
+		break;
+	case SCHEDTRACE_SOCKET:
+		name = "socket";
+		sprintf(args, "\"type\":%u", e->arg);
+		break;
+	case SCHEDTRACE_TIMER:
+		name = "timer";
+		break;
+	default:
+		name = "unknown";
+		break;
+	}
+	fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%llu,\"pid\":0,\"tid\":%d%s,\"args\":{%s}}",
+		name, e->phase, (unsigned long long)e->ts, tid,
+		e->phase == SCHEDTRACE_INSTANT ? ",\"s\":\"t\"" : "", args);
+}
+
+int
+skynet_schedtrace_dump(const char *filename) {
+	FILE *f = fopen(filename, "w");
+	if (f == NULL)
+		return -1;
+	// The events may be overwritten during dumping if tracing is still on, it's only a debug tool.
+	int count = 0;
+	int n = T->n;
+	int i;
+	fprintf(f, "{\"traceEvents\":[\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":0,\"args\":{\"name\":\"skynet\"}}");
+	for (i=0;i<n && i<MAX_TRACE_THREAD;i++) {
+		struct trace_thread *t = ATOM_LOAD(&T->thread[i]);
+		if (t == NULL)
+			continue;
+		fprintf(f, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%d,\"args\":{\"name\":\"%s\"}}", i, t->name);
+		struct trace_event *ring = ATOM_LOAD(&t->ring);
+		if (ring == NULL)
+			continue;
+		uint64_t head = ATOM_LOAD(&t->head);
+		uint64_t from = head > TRACE_RING ? head - TRACE_RING : 0;
+		for (;from < head;from++) {
+			struct trace_event *e = &ring[from & (TRACE_RING - 1)];
+			if (e->ts >= T->since) {
+				dump_event(f, i, e);
+				++count;
+			}
+		}
+	}
+	fprintf(f, "\n]}\n");
+	fclose(f);
+	return count;
+}
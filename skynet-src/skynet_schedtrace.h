@@ -0,0 +1,36 @@
+#ifndef SKYNET_SCHEDTRACE_H
+#define SKYNET_SCHEDTRACE_H
+
+#include <stdint.h>
+
+// Scheduler event tracing : each thread records events into its own ring buffer,
+// and skynet_schedtrace_dump writes them as chrome trace json (chrome://tracing or perfetto).
+
+#define SCHEDTRACE_DISPATCH 0	// a worker dispatches a service, arg is handle (begin) or number of messages (end)
+#define SCHEDTRACE_WAIT 1	// a worker has nothing to do, spins and parks
+#define SCHEDTRACE_WAKEUP 2	// wake up a parked worker, arg is the worker id in its pool
+#define SCHEDTRACE_SOCKET 3	// socket thread gets an event, arg is the type
+#define SCHEDTRACE_TIMER 4	// timer thread updates time
+
+#define SCHEDTRACE_BEGIN 'B'
+#define SCHEDTRACE_END 'E'
+#define SCHEDTRACE_INSTANT 'i'
+
+extern volatile int skynet_schedtrace_on;
+
+void skynet_schedtrace_init(void);
+// register current thread, name and id are used for the thread name in trace.
+void skynet_schedtrace_thread(const char *name, int id);
+void skynet_schedtrace_enable(int on);
+// write the events in buffer to filename, return the number of events or -1 for error
+int skynet_schedtrace_dump(const char *filename);
+void skynet_schedtrace_record(int type, int phase, uint32_t arg);
+
+static inline void
+skynet_schedtrace(int type, int phase, uint32_t arg) {
+	if (skynet_schedtrace_on) {
+		skynet_schedtrace_record(type, phase, arg);
+	}
+}
+
+#endif
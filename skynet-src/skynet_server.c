@@ -10,6 +10,8 @@
 #include "skynet_monitor.h"
 #include "skynet_imp.h"
 #include "skynet_log.h"
+#include "skynet_schedtrace.h"
+#include "skynet_msgpool.h"
 #include "skynet_timer.h"
 #include "spinlock.h"
 #include "atomic.h"
@@ -22,6 +24,22 @@
 #include <stdio.h>
 #include <stdbool.h>
 
+// max number of messages dispatched in one turn
+#define MESSAGE_BATCH 64
+
+// The average cost of a message is in 1/16 microsec
+#define COST_SHIFT 4
+#define COST(us) ((uint64_t)(us) << COST_SHIFT)
+
+// bucket 0 : < 1us, bucket n : [2^(n-1), 2^n) us, the last one collects the rest
+#define LATENCY_BUCKET 24
+
+struct latency_stat {
+	uint32_t wait[LATENCY_BUCKET];	// time in message queue
+	uint32_t run[LATENCY_BUCKET];	// time of callback
+	char report[LATENCY_BUCKET * 2 * 11 + 1];
+};
+
 #ifdef CALLING_CHECK
 
 #define CHECKCALLING_BEGIN(ctx) if (!(spinlock_trylock(&ctx->calling))) { assert(0); }
@@ -54,9 +72,20 @@ struct skynet_context {
 	int session_id;
 	int ref;
 	int message_count;
+	int weight;	// batch weight of dispatch, see dispatch_weight()
+	uint64_t dispatch_cost;	// average cost of a message
+	uint64_t batch_count;	// number of dispatch turns
+	uint64_t batch_message;	// messages dispatched in these turns
+	int batch_max;
+	struct latency_stat * latency_stat;
+	char * launch_result;	// result of LAUNCHN, it's too large for result
 	bool init;
 	bool endless;
 	bool profile;
+	bool latency;	// stamp the messages and collect latency_stat
+	int overrun;	// messages exceed the time slice, see skynet_monitor_slice()
+	bool timer_coalesce;	// accept coalesced timeout messages, see cmd_timercoalesce
+	bool noreserve;	// the callback never reserves messages, so it can share payloads, see skynet_callback_noreserve
 
 	CHECKCALLING_DECL
 };
@@ -67,6 +96,8 @@ struct skynet_node {
 	uint32_t monitor_exit;
 	pthread_key_t handle_key;
 	bool profile;	// default is off
+	bool latency;	// default is off
+	int dispatch_budget;	// time budget of a dispatch turn in microsec, 0 means no limit
 };
 
 static struct skynet_node G_NODE;
@@ -108,6 +139,38 @@ id_to_hex(char * str, uint32_t id) {
 	str[9] = '\0';
 }
 
+// A shared payload is allocated once and delivered to many services by skynet_send_multi.
+// The message has MESSAGE_SHARED in sz, and each receiver holds a reference of the payload.
+#define SHARED_HEADER 16	// keep the payload aligned
+
+static void *
+shared_new(const void *msg, size_t sz, int ref) {
+	char * p = skynet_malloc(SHARED_HEADER + sz + 1);
+	*(int *)p = ref;
+	if (sz > 0) {
+		memcpy(p + SHARED_HEADER, msg, sz);
+	}
+	p[SHARED_HEADER + sz] = '\0';
+	return p + SHARED_HEADER;
+}
+
+static void
+shared_release(void *data) {
+	char * p = (char *)data - SHARED_HEADER;
+	if (ATOM_DEC((int *)p) == 0) {
+		skynet_free(p);
+	}
+}
+
+static inline void
+message_free(struct skynet_message *msg) {
+	if (msg->sz & MESSAGE_SHARED) {
+		shared_release(msg->data);
+	} else {
+		skynet_free(msg->data);
+	}
+}
+
 struct drop_t {
 	uint32_t handle;
 };
@@ -115,23 +178,56 @@ struct drop_t {
 static void
 drop_message(struct skynet_message *msg, void *ud) {
 	struct drop_t *d = ud;
-	skynet_free(msg->data);
+	message_free(msg);
 	uint32_t source = d->handle;
 	assert(source);
 	// report error to the message source
 	skynet_send(NULL, source, msg->source, PTYPE_ERROR, 0, NULL, 0);
 }
 
-struct skynet_context * 
-skynet_context_new(const char * name, const char *param) {
-	struct skynet_module * mod = skynet_module_query(name);
+static void
+latency_enable(struct skynet_context *ctx, bool on) {
+	if (on) {
+		if (ctx->latency_stat == NULL) {
+			ctx->latency_stat = skynet_malloc(sizeof(struct latency_stat));
+		}
+		memset(ctx->latency_stat, 0, sizeof(struct latency_stat));
+	}
+	// the messages in queue before turning on have no stamp
+	ctx->latency = on;
+}
 
-	if (mod == NULL)
-		return NULL;
+static inline void
+latency_add(uint32_t bucket[LATENCY_BUCKET], uint64_t us) {
+	int n = 0;
+	while (us && n < LATENCY_BUCKET - 1) {
+		us >>= 1;
+		++n;
+	}
+	++bucket[n];
+}
 
-	void *inst = skynet_module_instance_create(mod);
-	if (inst == NULL)
-		return NULL;
+static const char *
+latency_report(struct skynet_context *ctx) {
+	struct latency_stat *ls = ctx->latency_stat;
+	if (ls == NULL) {
+		return "";
+	}
+	// LATENCY_BUCKET numbers of wait, and then LATENCY_BUCKET numbers of run
+	char *p = ls->report;
+	int i;
+	for (i=0;i<LATENCY_BUCKET;i++) {
+		p += sprintf(p, "%u ", ls->wait[i]);
+	}
+	for (i=0;i<LATENCY_BUCKET;i++) {
+		p += sprintf(p, "%u ", ls->run[i]);
+	}
+	p[-1] = '\0';
+	return ls->report;
+}
+
+static struct skynet_context *
+context_create(struct skynet_module * mod, void *inst) {
 	struct skynet_context * ctx = skynet_malloc(sizeof(*ctx));
 	CHECKCALLING_INIT(ctx)
 
@@ -149,11 +245,32 @@ skynet_context_new(const char * name, const char *param) {
 	ctx->cpu_cost = 0;
 	ctx->cpu_start = 0;
 	ctx->message_count = 0;
+	ctx->weight = 0;
+	ctx->dispatch_cost = 0;
+	ctx->batch_count = 0;
+	ctx->batch_message = 0;
+	ctx->batch_max = 0;
+	ctx->latency_stat = NULL;
+	ctx->latency = false;
+	ctx->timer_coalesce = false;
+	ctx->noreserve = false;
+	ctx->overrun = 0;
+	if (G_NODE.latency) {
+		latency_enable(ctx, true);
+	}
+	ctx->launch_result = NULL;
 	ctx->profile = G_NODE.profile;
 	// Should set to 0 first to avoid skynet_handle_retireall get an uninitialized handle
 	ctx->handle = 0;	
-	ctx->handle = skynet_handle_register(ctx);
-	struct message_queue * queue = ctx->queue = skynet_mq_create(ctx->handle);
+	return ctx;
+}
+
+// ctx->handle is registered, create the queue and init the instance
+static struct skynet_context *
+context_init(struct skynet_context *ctx, const char * name, const char *param, int pool) {
+	struct skynet_module * mod = ctx->mod;
+	void *inst = ctx->instance;
+	struct message_queue * queue = ctx->queue = skynet_mq_create(ctx->handle, pool);
 	// init function maybe use ctx->handle, so it must init at last
 	context_inc();
 
@@ -181,6 +298,57 @@ skynet_context_new(const char * name, const char *param) {
 	}
 }
 
+struct skynet_context * 
+skynet_context_new(const char * name, const char *param, int pool) {
+	struct skynet_module * mod = skynet_module_query(name);
+
+	if (mod == NULL)
+		return NULL;
+
+	void *inst = skynet_module_instance_create(mod);
+	if (inst == NULL)
+		return NULL;
+	struct skynet_context * ctx = context_create(mod, inst);
+	ctx->handle = skynet_handle_register(ctx);
+	return context_init(ctx, name, param, pool);
+}
+
+int
+skynet_context_new_batch(const char * name, const char *param, int pool, int n, uint32_t *handle) {
+	struct skynet_module * mod = skynet_module_query(name);
+
+	if (mod == NULL || n <= 0)
+		return 0;
+
+	struct skynet_context ** ctx = skynet_malloc(n * sizeof(struct skynet_context *));
+	int i;
+	for (i=0;i<n;i++) {
+		void *inst = skynet_module_instance_create(mod);
+		if (inst == NULL)
+			break;
+		ctx[i] = context_create(mod, inst);
+	}
+	int created = i;
+	// register all the handles under one lock
+	skynet_handle_register_batch(ctx, created, handle);
+	for (i=created;i<n;i++) {
+		handle[i] = 0;
+	}
+	int count = 0;
+	for (i=0;i<created;i++) {
+		ctx[i]->handle = handle[i];
+		// The queues are pushed into run queue one by one, so the workers can start them while we init others.
+		if (context_init(ctx[i], name, param, pool)) {
+			++count;
+		} else {
+			// keep the slot, so the handles are in the order of request
+			handle[i] = 0;
+		}
+	}
+	skynet_free(ctx);
+	return count;
+}
+
 int
 skynet_context_newsession(struct skynet_context *ctx) {
 	// session always be a positive number
@@ -197,6 +365,17 @@ skynet_context_grab(struct skynet_context *ctx) {
 	ATOM_INC(&ctx->ref);
 }
 
+int
+skynet_context_trygrab(struct skynet_context *ctx) {
+	for (;;) {
+		int ref = ctx->ref;
+		if (ref == 0)
+			return 0;	// it's being deleted
+		if (ATOM_CAS(&ctx->ref, ref, ref+1))
+			return 1;
+	}
+}
+
 void
 skynet_context_reserve(struct skynet_context *ctx) {
 	skynet_context_grab(ctx);
@@ -212,8 +391,11 @@ delete_context(struct skynet_context *ctx) {
 	}
 	skynet_module_instance_release(ctx->mod, ctx->instance);
 	skynet_mq_mark_release(ctx->queue);
+	skynet_free(ctx->latency_stat);
+	skynet_free(ctx->launch_result);
 	CHECKCALLING_DESTROY(ctx)
-	skynet_free(ctx);
+	// skynet_handle_grab may be reading ctx without lock
+	skynet_handle_free(ctx);
 	context_dec();
 }
 
@@ -232,6 +414,7 @@ skynet_context_push(uint32_t handle, struct skynet_message *message) {
 	if (ctx == NULL) {
 		return -1;
 	}
+	message->stamp = ctx->latency ? skynet_monotonic_time() : 0;
 	skynet_mq_push(ctx->queue, message);
 	skynet_context_release(ctx);
 
@@ -248,6 +431,28 @@ skynet_context_endless(uint32_t handle) {
 	skynet_context_release(ctx);
 }
 
+void
+skynet_context_overrun(uint32_t handle) {
+	struct skynet_context * ctx = skynet_handle_grab(handle);
+	if (ctx == NULL) {
+		return;
+	}
+	ATOM_INC(&ctx->overrun);
+	skynet_context_release(ctx);
+}
+
+int
+skynet_context_signal(uint32_t handle, int sig) {
+	struct skynet_context * ctx = skynet_handle_grab(handle);
+	if (ctx == NULL) {
+		return 0;
+	}
+	// NOTICE: the signal function should be thread safe.
+	int r = skynet_module_instance_signal(ctx->mod, ctx->instance, sig);
+	skynet_context_release(ctx);
+	return r;
+}
+
 int 
 skynet_isremote(struct skynet_context * ctx, uint32_t handle, int * harbor) {
 	int ret = skynet_harbor_message_isremote(handle);
@@ -269,6 +474,23 @@ dispatch_message(struct skynet_context *ctx, struct skynet_message *msg) {
 	}
 	++ctx->message_count;
 	int reserve_msg;
+	struct latency_stat *ls = ctx->latency ? ctx->latency_stat : NULL;
+	uint64_t start = 0;
+	if (ls) {
+		start = skynet_monotonic_time();
+		if (msg->stamp) {
+			latency_add(ls->wait, start - msg->stamp);
+		}
+	}
+	void * shared = NULL;
+	if ((msg->sz & MESSAGE_SHARED) && !ctx->noreserve) {
+		// The callback may reserve the message (return 1), give it a copy of its own.
+		shared = msg->data;
+		char * copy = skynet_msgpool_alloc(sz + 1);
+		memcpy(copy, shared, sz + 1);
+		msg->data = copy;
+		msg->sz &= ~MESSAGE_SHARED;
+	}
 	if (ctx->profile) {
 		ctx->cpu_start = skynet_thread_time();
 		reserve_msg = ctx->cb(ctx, ctx->cb_ud, type, msg->session, msg->source, msg->data, sz);
@@ -277,8 +499,19 @@ dispatch_message(struct skynet_context *ctx, struct skynet_message *msg) {
 	} else {
 		reserve_msg = ctx->cb(ctx, ctx->cb_ud, type, msg->session, msg->source, msg->data, sz);
 	}
-	if (!reserve_msg) {
-		skynet_free(msg->data);
+	if (ls) {
+		latency_add(ls->run, skynet_monotonic_time() - start);
+	}
+	if (shared) {
+		shared_release(shared);
+	}
+	if (msg->sz & MESSAGE_SHARED) {
+		if (reserve_msg) {
+			skynet_error(ctx, "Can't reserve the shared message from :%08x", msg->source);
+		}
+		shared_release(msg->data);
+	} else if (!reserve_msg) {
+		skynet_msgpool_free(msg->data);
 	}
 	CHECKCALLING_END(ctx)
 }
@@ -293,10 +526,52 @@ skynet_context_dispatchall(struct skynet_context * ctx) {
 	}
 }
 
+// Cheap messages are dispatched in a large batch to save the round trips of the run queue,
+// expensive ones are dispatched one by one, so other services on the same worker get a chance.
+static inline int
+dispatch_weight(uint64_t cost) {
+	if (cost >= COST(1000))
+		return -1;	// one message per turn
+	if (cost >= COST(100))
+		return 2;	// 1/4 of the queue
+	if (cost >= COST(10))
+		return 1;	// 1/2 of the queue
+	return 0;	// the whole queue
+}
+
+static inline int
+dispatch_limit(struct skynet_context *ctx) {
+	int budget = G_NODE.dispatch_budget;
+	if (budget <= 0 || ctx->dispatch_cost == 0)
+		return MESSAGE_BATCH;
+	uint64_t n = COST(budget) / ctx->dispatch_cost;
+	if (n < 1)
+		return 1;
+	return n < MESSAGE_BATCH ? (int)n : MESSAGE_BATCH;
+}
+
+static inline uint64_t
+dispatch_clock(struct skynet_context *ctx) {
+	// cpu_cost is already counted when profile is on
+	return ctx->profile ? ctx->cpu_cost : skynet_thread_time();
+}
+
+static void
+dispatch_update(struct skynet_context *ctx, int n, uint64_t cost) {
+	// moving average of the cost of a message
+	int64_t diff = (int64_t)(COST(cost) / n) - (int64_t)ctx->dispatch_cost;
+	ctx->dispatch_cost += diff / 4;
+	ctx->weight = dispatch_weight(ctx->dispatch_cost);
+	++ctx->batch_count;
+	ctx->batch_message += n;
+	if (n > ctx->batch_max)
+		ctx->batch_max = n;
+}
+
 struct message_queue * 
-skynet_context_message_dispatch(struct skynet_monitor *sm, struct message_queue *q, int weight) {
+skynet_context_message_dispatch(struct skynet_monitor *sm, struct message_queue *q) {
 	if (q == NULL) {
-		q = skynet_globalmq_pop();
+		q = skynet_globalmq_pop(1);
 		if (q==NULL)
 			return NULL;
 	}
@@ -307,41 +582,42 @@ skynet_context_message_dispatch(struct skynet_monitor *sm, struct message_queue
 	if (ctx == NULL) {
 		struct drop_t d = { handle };
 		skynet_mq_release(q, drop_message, &d);
-		return skynet_globalmq_pop();
+		return skynet_globalmq_pop(1);
 	}
 
-	int i,n=1;
-	struct skynet_message msg;
+	struct skynet_message msg[MESSAGE_BATCH];
+	int i,n = skynet_mq_pop_batch(q, msg, dispatch_limit(ctx), ctx->weight);
+	if (n == 0) {
+		skynet_context_release(ctx);
+		return skynet_globalmq_pop(1);
+	}
+	int overload = skynet_mq_overload(q);
+	if (overload) {
+		skynet_error(ctx, "May overload, message queue length = %d", overload);
+	}
 
+	skynet_schedtrace(SCHEDTRACE_DISPATCH, SCHEDTRACE_BEGIN, handle);
+	uint64_t start = dispatch_clock(ctx);
 	for (i=0;i<n;i++) {
-		if (skynet_mq_pop(q,&msg)) {
-			skynet_context_release(ctx);
-			return skynet_globalmq_pop();
-		} else if (i==0 && weight >= 0) {
-			n = skynet_mq_length(q);
-			n >>= weight;
-		}
-		int overload = skynet_mq_overload(q);
-		if (overload) {
-			skynet_error(ctx, "May overload, message queue length = %d", overload);
-		}
-
-		skynet_monitor_trigger(sm, msg.source , handle);
+		skynet_monitor_trigger(sm, msg[i].source , handle);
 
 		if (ctx->cb == NULL) {
-			skynet_free(msg.data);
+			message_free(&msg[i]);
 		} else {
-			dispatch_message(ctx, &msg);
+			dispatch_message(ctx, &msg[i]);
 		}
 
 		skynet_monitor_trigger(sm, 0,0);
 	}
+	dispatch_update(ctx, n, dispatch_clock(ctx) - start);
+	skynet_schedtrace(SCHEDTRACE_DISPATCH, SCHEDTRACE_END, n);
 
 	assert(q == ctx->queue);
-	struct message_queue *nq = skynet_globalmq_pop();
+	// Don't steal here, we still have q to dispatch.
+	struct message_queue *nq = skynet_globalmq_pop(0);
 	if (nq) {
-		// If global mq is not empty , push q back, and return next queue (nq)
-		// Else (global mq is empty or block, don't push q back, and return q again (for next dispatch)
+		// If local or global mq is not empty , push q back (to the local mq), and return next queue (nq)
+		// Else (both are empty or block, don't push q back, and return q again (for next dispatch)
 		skynet_globalmq_push(q);
 		q = nq;
 	} 
@@ -399,11 +675,38 @@ cmd_timeout(struct skynet_context * context, const char * param) {
 	char * session_ptr = NULL;
 	int ti = strtol(param, &session_ptr, 10);
 	int session = skynet_context_newsession(context);
-	skynet_timeout(context->handle, ti, session);
+	skynet_timeout(context->handle, ti, session, context->timer_coalesce);
+	sprintf(context->result, "%d", session);
+	return context->result;
+}
+
+static const char *
+cmd_timeoutms(struct skynet_context * context, const char * param) {
+	int ms = strtol(param, NULL, 10);
+	int session = skynet_context_newsession(context);
+	skynet_timeout_ms(context->handle, ms, session, context->timer_coalesce);
 	sprintf(context->result, "%d", session);
 	return context->result;
 }
 
+static const char *
+cmd_cancel(struct skynet_context * context, const char * param) {
+	int session = strtol(param, NULL, 10);
+	if (skynet_timer_cancel(context->handle, session)) {
+		sprintf(context->result, "%d", session);
+		return context->result;
+	}
+	return NULL;
+}
+
+// The service declares it can unpack the coalesced timeout message :
+// PTYPE_RESPONSE with session 0 from source 0, the data is an array of int sessions.
+static const char *
+cmd_timercoalesce(struct skynet_context * context, const char * param) {
+	context->timer_coalesce = true;
+	return NULL;
+}
+
 static const char *
 cmd_reg(struct skynet_context * context, const char * param) {
 	if (param == NULL || param[0] == '\0') {
@@ -486,8 +789,18 @@ cmd_launch(struct skynet_context * context, const char * param) {
 	strcpy(tmp,param);
 	char * args = tmp;
 	char * mod = strsep(&args, " \t\r\n");
+	int pool = 0;
+	if (mod[0] == '@' && args) {
+		// LAUNCH @pool mod args : run the service on the workers of pool
+		pool = skynet_mq_pool(mod+1);
+		if (pool < 0) {
+			skynet_error(context, "Can't launch %s : unknown pool %s", args, mod+1);
+			return NULL;
+		}
+		mod = strsep(&args, " \t\r\n");
+	}
 	args = strsep(&args, "\r\n");
-	struct skynet_context * inst = skynet_context_new(mod,args);
+	struct skynet_context * inst = skynet_context_new(mod,args,pool);
 	if (inst == NULL) {
 		return NULL;
 	} else {
@@ -496,6 +809,51 @@ cmd_launch(struct skynet_context * context, const char * param) {
 	}
 }
 
+#define MAX_LAUNCHN 0x10000
+
+static const char *
+cmd_launchn(struct skynet_context * context, const char * param) {
+	// LAUNCHN n [@pool] mod args, return n handles separated by space, :00000000 for the failed ones
+	size_t sz = strlen(param);
+	char tmp[sz+1];
+	strcpy(tmp,param);
+	char * args = tmp;
+	char * count = strsep(&args, " \t\r\n");
+	int n = strtol(count, NULL, 10);
+	if (n <= 0 || n > MAX_LAUNCHN || args == NULL) {
+		skynet_error(context, "Invalid LAUNCHN %s", param);
+		return NULL;
+	}
+	char * mod = strsep(&args, " \t\r\n");
+	int pool = 0;
+	if (mod[0] == '@' && args) {
+		pool = skynet_mq_pool(mod+1);
+		if (pool < 0) {
+			skynet_error(context, "Can't launch %s : unknown pool %s", args, mod+1);
+			return NULL;
+		}
+		mod = strsep(&args, " \t\r\n");
+	}
+	if (args) {
+		args = strsep(&args, "\r\n");
+	}
+	uint32_t * handle = skynet_malloc(n * sizeof(uint32_t));
+	if (skynet_context_new_batch(mod, args, pool, n, handle) == 0) {
+		skynet_free(handle);
+		return NULL;
+	}
+	skynet_free(context->launch_result);
+	char * result = context->launch_result = skynet_malloc(n * 10);
+	int i;
+	for (i=0;i<n;i++) {
+		id_to_hex(result + i * 10, handle[i]);
+		result[i * 10 + 9] = ' ';
+	}
+	result[n * 10 - 1] = '\0';
+	skynet_free(handle);
+	return result;
+}
+
 static const char *
 cmd_getenv(struct skynet_context * context, const char * param) {
 	return skynet_getenv(param);
@@ -574,12 +932,56 @@ cmd_stat(struct skynet_context * context, const char * param) {
 		}
 	} else if (strcmp(param, "message") == 0) {
 		sprintf(context->result, "%d", context->message_count);
+	} else if (strcmp(param, "batch") == 0) {
+		// average batch size of dispatch
+		double b = context->batch_count ? (double)context->batch_message / context->batch_count : 0;
+		sprintf(context->result, "%lf", b);
+	} else if (strcmp(param, "batchmax") == 0) {
+		sprintf(context->result, "%d", context->batch_max);
+	} else if (strcmp(param, "weight") == 0) {
+		sprintf(context->result, "%d", context->weight);
+	} else if (strcmp(param, "latency") == 0) {
+		return latency_report(context);
+	} else if (strcmp(param, "overrun") == 0) {
+		sprintf(context->result, "%d", context->overrun);
 	} else {
 		context->result[0] = '\0';
 	}
 	return context->result;
 }
 
+static const char *
+cmd_latency(struct skynet_context * context, const char * param) {
+	// LATENCY on : reset and collect the latency stat, LATENCY off : stop collecting
+	if (param && strcmp(param, "on") == 0) {
+		latency_enable(context, true);
+	} else if (param && strcmp(param, "off") == 0) {
+		latency_enable(context, false);
+	}
+	return NULL;
+}
+
+static const char *
+cmd_schedtrace(struct skynet_context * context, const char * param) {
+	// SCHEDTRACE on|off|dump filename
+	if (param == NULL)
+		return NULL;
+	if (strcmp(param, "on") == 0) {
+		skynet_schedtrace_enable(1);
+	} else if (strcmp(param, "off") == 0) {
+		skynet_schedtrace_enable(0);
+	} else if (strncmp(param, "dump ", 5) == 0) {
+		int n = skynet_schedtrace_dump(param + 5);
+		if (n < 0) {
+			skynet_error(context, "Can't dump scheduler trace to %s", param + 5);
+			return NULL;
+		}
+		sprintf(context->result, "%d", n);
+		return context->result;
+	}
+	return NULL;
+}
+
 static const char *
 cmd_logon(struct skynet_context * context, const char * param) {
 	uint32_t handle = tohandle(context, param);
@@ -627,35 +1029,35 @@ cmd_signal(struct skynet_context * context, const char * param) {
 	uint32_t handle = tohandle(context, param);
 	if (handle == 0)
 		return NULL;
-	struct skynet_context * ctx = skynet_handle_grab(handle);
-	if (ctx == NULL)
-		return NULL;
 	param = strchr(param, ' ');
 	int sig = 0;
 	if (param) {
 		sig = strtol(param, NULL, 0);
 	}
-	// NOTICE: the signal function should be thread safe.
-	skynet_module_instance_signal(ctx->mod, ctx->instance, sig);
-
-	skynet_context_release(ctx);
+	skynet_context_signal(handle, sig);
 	return NULL;
 }
 
 static struct command_func cmd_funcs[] = {
 	{ "TIMEOUT", cmd_timeout },
+	{ "TIMEOUTMS", cmd_timeoutms },
+	{ "CANCEL", cmd_cancel },
+	{ "TIMERCOALESCE", cmd_timercoalesce },
 	{ "REG", cmd_reg },
 	{ "QUERY", cmd_query },
 	{ "NAME", cmd_name },
 	{ "EXIT", cmd_exit },
 	{ "KILL", cmd_kill },
 	{ "LAUNCH", cmd_launch },
+	{ "LAUNCHN", cmd_launchn },
 	{ "GETENV", cmd_getenv },
 	{ "SETENV", cmd_setenv },
 	{ "STARTTIME", cmd_starttime },
 	{ "ABORT", cmd_abort },
 	{ "MONITOR", cmd_monitor },
 	{ "STAT", cmd_stat },
+	{ "LATENCY", cmd_latency },
+	{ "SCHEDTRACE", cmd_schedtrace },
 	{ "LOGON", cmd_logon },
 	{ "LOGOFF", cmd_logoff },
 	{ "SIGNAL", cmd_signal },
@@ -687,7 +1089,7 @@ _filter_args(struct skynet_context * context, int type, int *session, void ** da
 	}
 
 	if (needcopy && *data) {
-		char * msg = skynet_malloc(*sz+1);
+		char * msg = skynet_msgpool_alloc(*sz+1);
 		memcpy(msg, *data, *sz);
 		msg[*sz] = '\0';
 		*data = msg;
@@ -736,6 +1138,59 @@ skynet_send(struct skynet_context * context, uint32_t source, uint32_t destinati
 	return session;
 }
 
+int
+skynet_send_multi(struct skynet_context * context, uint32_t source, const uint32_t * destination, int n, int type, void * data, size_t sz) {
+	if ((sz & MESSAGE_TYPE_MASK) != sz) {
+		skynet_error(context, "The message to %d destinations is too large", n);
+		if (type & PTYPE_TAG_DONTCOPY) {
+			skynet_free(data);
+		}
+		return -1;
+	}
+	if (source == 0) {
+		source = context->handle;
+	}
+	// one reference for each destination, and one for the loop below
+	void * payload = shared_new(data, sz, n + 1);
+	if (type & PTYPE_TAG_DONTCOPY) {
+		skynet_free(data);
+	}
+	size_t tsz = sz | (size_t)(type & 0xff) << MESSAGE_TYPE_SHIFT;
+	int i;
+	int count = 0;
+	for (i=0;i<n;i++) {
+		uint32_t des = destination[i];
+		if (des == 0) {
+			shared_release(payload);
+		} else if (skynet_harbor_message_isremote(des)) {
+			// harbor owns the message, so give it a copy
+			char * msg = skynet_malloc(sz+1);
+			memcpy(msg, payload, sz+1);
+			struct remote_message * rmsg = skynet_malloc(sizeof(*rmsg));
+			rmsg->destination.handle = des;
+			rmsg->message = msg;
+			rmsg->sz = sz;
+			rmsg->type = type & 0xff;
+			skynet_harbor_send(rmsg, source, 0);
+			shared_release(payload);
+			++count;
+		} else {
+			struct skynet_message smsg;
+			smsg.source = source;
+			smsg.session = 0;
+			smsg.data = payload;
+			smsg.sz = tsz | MESSAGE_SHARED;
+			if (skynet_context_push(des, &smsg)) {
+				shared_release(payload);
+			} else {
+				++count;
+			}
+		}
+	}
+	shared_release(payload);
+	return count;
+}
+
 int
 skynet_sendname(struct skynet_context * context, uint32_t source, const char * addr , int type, int session, void * data, size_t sz) {
 	if (source == 0) {
@@ -778,6 +1233,12 @@ void
 skynet_callback(struct skynet_context * context, void *ud, skynet_cb cb) {
 	context->cb = cb;
 	context->cb_ud = ud;
+	context->noreserve = false;
+}
+
+void
+skynet_callback_noreserve(struct skynet_context * context) {
+	context->noreserve = true;
 }
 
 void
@@ -787,6 +1248,7 @@ skynet_context_send(struct skynet_context * ctx, void * msg, size_t sz, uint32_t
 	smsg.session = session;
 	smsg.data = msg;
 	smsg.sz = sz | (size_t)type << MESSAGE_TYPE_SHIFT;
+	smsg.stamp = ctx->latency ? skynet_monotonic_time() : 0;
 
 	skynet_mq_push(ctx->queue, &smsg);
 }
@@ -800,6 +1262,7 @@ skynet_globalinit(void) {
 		fprintf(stderr, "pthread_key_create failed");
 		exit(1);
 	}
+	skynet_msgpool_init();
 	// set mainthread's key
 	skynet_initthread(THREAD_MAIN);
 }
@@ -813,9 +1276,22 @@ void
 skynet_initthread(int m) {
 	uintptr_t v = (uint32_t)(-m);
 	pthread_setspecific(G_NODE.handle_key, (void *)v);
+	if (m == THREAD_WORKER || m == THREAD_SOCKET) {
+		skynet_msgpool_thread();
+	}
 }
 
 void
 skynet_profile_enable(int enable) {
 	G_NODE.profile = (bool)enable;
 }
+
+void
+skynet_latency_enable(int enable) {
+	G_NODE.latency = (bool)enable;
+}
+
+void
+skynet_dispatch_budget(int us) {
+	G_NODE.dispatch_budget = us;
+}
@@ -8,24 +8,34 @@ struct skynet_context;
 struct skynet_message;
 struct skynet_monitor;
 
-struct skynet_context * skynet_context_new(const char * name, const char * parm);
+struct skynet_context * skynet_context_new(const char * name, const char * parm, int pool);
+// create n services of module name in pool, put the handles into handle (0 for the failed ones), return the number of services created
+int skynet_context_new_batch(const char * name, const char * parm, int pool, int n, uint32_t *handle);
 void skynet_context_grab(struct skynet_context *);
+// grab ctx only if it's not released, return 0 for fail
+int skynet_context_trygrab(struct skynet_context *);
 void skynet_context_reserve(struct skynet_context *ctx);
 struct skynet_context * skynet_context_release(struct skynet_context *);
 uint32_t skynet_context_handle(struct skynet_context *);
 int skynet_context_push(uint32_t handle, struct skynet_message *message);
 void skynet_context_send(struct skynet_context * context, void * msg, size_t sz, uint32_t source, int type, int session);
 int skynet_context_newsession(struct skynet_context *);
-struct message_queue * skynet_context_message_dispatch(struct skynet_monitor *, struct message_queue *, int weight);	// return next queue
+struct message_queue * skynet_context_message_dispatch(struct skynet_monitor *, struct message_queue *);	// return next queue
 int skynet_context_total();
 void skynet_context_dispatchall(struct skynet_context * context);	// for skynet_error output before exit
 
 void skynet_context_endless(uint32_t handle);	// for monitor
+void skynet_context_overrun(uint32_t handle);	// for monitor, a message exceeds the time slice
+int skynet_context_signal(uint32_t handle, int sig);	// return 0 if the service doesn't handle signals
 
 void skynet_globalinit(void);
 void skynet_globalexit(void);
 void skynet_initthread(int m);
 
 void skynet_profile_enable(int enable);
+// collect queue wait and callback latency of all the new services
+void skynet_latency_enable(int enable);
+// time budget (microsec) of dispatching one service in a turn, 0 means no limit
+void skynet_dispatch_budget(int us);
 
 #endif
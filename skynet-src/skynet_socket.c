@@ -4,6 +4,7 @@
 #include "socket_server.h"
 #include "skynet_server.h"
 #include "skynet_mq.h"
+#include "skynet_schedtrace.h"
 #include "skynet_harbor.h"
 
 #include <assert.h>
@@ -14,8 +15,13 @@
 static struct socket_server * SOCKET_SERVER = NULL;
 
 void 
-skynet_socket_init() {
-	SOCKET_SERVER = socket_server_create(skynet_now());
+skynet_socket_init(int thread) {
+	SOCKET_SERVER = socket_server_create(skynet_now(), thread);
+}
+
+int
+skynet_socket_thread() {
+	return socket_server_shards(SOCKET_SERVER);
 }
 
 void
@@ -50,7 +56,7 @@ forward_message(int type, bool padding, struct socket_message * result) {
 			result->data = "";
 		}
 	}
-	sm = (struct skynet_socket_message *)skynet_malloc(sz);
+	sm = (struct skynet_socket_message *)skynet_message_alloc(sz);
 	sm->type = type;
 	sm->id = result->id;
 	sm->ud = result->ud;
@@ -76,12 +82,13 @@ forward_message(int type, bool padding, struct socket_message * result) {
 }
 
 int 
-skynet_socket_poll() {
-	struct socket_server *ss = SOCKET_SERVER;
+skynet_socket_poll(int shard) {
+	struct socket_server *ss = socket_server_shard(SOCKET_SERVER, shard);
 	assert(ss);
 	struct socket_message result;
 	int more = 1;
 	int type = socket_server_poll(ss, &result, &more);
+	skynet_schedtrace(SCHEDTRACE_SOCKET, SCHEDTRACE_INSTANT, type);
 	switch (type) {
 	case SOCKET_EXIT:
 		return 0;
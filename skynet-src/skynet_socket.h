@@ -20,10 +20,11 @@ struct skynet_socket_message {
 	char * buffer;
 };
 
-void skynet_socket_init();
+void skynet_socket_init(int thread);	// thread : number of socket threads
+int skynet_socket_thread();
 void skynet_socket_exit();
 void skynet_socket_free();
-int skynet_socket_poll();
+int skynet_socket_poll(int shard);	// poll the sockets of the shard in its socket thread
 void skynet_socket_updatetime();
 
 int skynet_socket_send(struct skynet_context *ctx, int id, void *buffer, int sz);
@@ -9,6 +9,8 @@
 #include "skynet_socket.h"
 #include "skynet_daemon.h"
 #include "skynet_harbor.h"
+#include "skynet_affinity.h"
+#include "skynet_schedtrace.h"
 
 #include <pthread.h>
 #include <unistd.h>
@@ -21,16 +23,22 @@
 struct monitor {
 	int count;
 	struct skynet_monitor ** m;
-	pthread_cond_t cond;
-	pthread_mutex_t mutex;
-	int sleep;
 	int quit;
+	int tickless;	// the timer thread sleeps until the next expiry, see skynet_timer_wait()
+	int slice;	// time slice of a message in millisecond, 0 means off
 };
 
 struct worker_parm {
 	struct monitor *m;
 	int id;
-	int weight;
+};
+
+struct thread_layout {
+	int socket_n;
+	int *socket;	// cpu of each socket thread, -1 means no affinity
+	int timer;	// cpu of timer thread
+	int *worker;	// cpu of each worker
+	int *node;	// numa node of each worker, -1 means unknown
 };
 
 static int SIG = 0;
@@ -43,36 +51,44 @@ handle_hup(int signal) {
 }
 
 #define CHECK_ABORT if (skynet_context_total()==0) break;
+#define CPU_LIST_MAX 1024
 
 static void
-create_thread(pthread_t *thread, void *(*start_routine) (void *), void *arg) {
-	if (pthread_create(thread,NULL, start_routine, arg)) {
-		fprintf(stderr, "Create thread failed");
-		exit(1);
+create_thread(pthread_t *thread, void *(*start_routine) (void *), void *arg, int cpu) {
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	if (skynet_affinity_attr(&attr, cpu)) {
+		skynet_error(NULL, "Can't bind thread to cpu %d", cpu);
 	}
-}
-
-static void
-wakeup(struct monitor *m, int busy) {
-	if (m->sleep >= m->count - busy) {
-		// signal sleep worker, "spurious wakeup" is harmless
-		pthread_cond_signal(&m->cond);
+	if (pthread_create(thread,&attr, start_routine, arg)) {
+		pthread_attr_destroy(&attr);
+		if (cpu < 0) {
+			fprintf(stderr, "Create thread failed\n");
+			exit(1);
+		}
+		// the cpu may go offline after layout_init, run it without affinity
+		skynet_error(NULL, "Create thread on cpu %d failed, run it on any cpu", cpu);
+		create_thread(thread, start_routine, arg, -1);
+		return;
 	}
+	pthread_attr_destroy(&attr);
 }
 
 static void *
 thread_socket(void *p) {
-	struct monitor * m = p;
+	struct worker_parm *wp = p;
+	int shard = wp->id;
 	skynet_initthread(THREAD_SOCKET);
+	skynet_schedtrace_thread("socket", shard);
 	for (;;) {
-		int r = skynet_socket_poll();
+		// The worker is woken up by skynet_mq_push when a message is pushed
+		int r = skynet_socket_poll(shard);
 		if (r==0)
 			break;
 		if (r<0) {
 			CHECK_ABORT
 			continue;
 		}
-		wakeup(m,0);
 	}
 	return NULL;
 }
@@ -84,8 +100,6 @@ free_monitor(struct monitor *m) {
 	for (i=0;i<n;i++) {
 		skynet_monitor_delete(m->m[i]);
 	}
-	pthread_mutex_destroy(&m->mutex);
-	pthread_cond_destroy(&m->cond);
 	skynet_free(m->m);
 	skynet_free(m);
 }
@@ -96,14 +110,27 @@ thread_monitor(void *p) {
 	int i;
 	int n = m->count;
 	skynet_initthread(THREAD_MONITOR);
+	// check the time slice twice per slice, and the endless loop every 5 seconds
+	int interval = m->slice ? m->slice * 500 : 1000000;	// in microsec
+	if (interval > 1000000)
+		interval = 1000000;
+	int count = 5000000 / interval;
+	if (count < 1)
+		count = 1;
 	for (;;) {
 		CHECK_ABORT
 		for (i=0;i<n;i++) {
 			skynet_monitor_check(m->m[i]);
 		}
-		for (i=0;i<5;i++) {
+		int j;
+		for (j=0;j<count;j++) {
 			CHECK_ABORT
-			sleep(1);
+			usleep(interval);
+			if (m->slice) {
+				for (i=0;i<n;i++) {
+					skynet_monitor_slice(m->m[i]);
+				}
+			}
 		}
 	}
 
@@ -129,12 +156,19 @@ static void *
 thread_timer(void *p) {
 	struct monitor * m = p;
 	skynet_initthread(THREAD_TIMER);
+	skynet_schedtrace_thread("timer", 0);
 	for (;;) {
+		skynet_schedtrace(SCHEDTRACE_TIMER, SCHEDTRACE_BEGIN, 0);
 		skynet_updatetime();
 		skynet_socket_updatetime();
+		skynet_schedtrace(SCHEDTRACE_TIMER, SCHEDTRACE_END, 0);
 		CHECK_ABORT
-		wakeup(m,m->count-1);
-		usleep(2500);
+		if (m->tickless) {
+			skynet_timer_wait();
+		} else {
+			// a quarter of a tick
+			usleep(skynet_timer_resolution() * 250);
+		}
 		if (SIG) {
 			signal_hup();
 			SIG = 0;
@@ -143,10 +177,8 @@ thread_timer(void *p) {
 	// wakeup socket thread
 	skynet_socket_exit();
 	// wakeup all worker thread
-	pthread_mutex_lock(&m->mutex);
 	m->quit = 1;
-	pthread_cond_broadcast(&m->cond);
-	pthread_mutex_unlock(&m->mutex);
+	skynet_globalmq_exit();
 	return NULL;
 }
 
@@ -154,89 +186,187 @@ static void *
 thread_worker(void *p) {
 	struct worker_parm *wp = p;
 	int id = wp->id;
-	int weight = wp->weight;
 	struct monitor *m = wp->m;
 	struct skynet_monitor *sm = m->m[id];
 	skynet_initthread(THREAD_WORKER);
+	skynet_monitor_bind(sm);
+	skynet_globalmq_bind(id);
+	skynet_schedtrace_thread("worker", id);
 	struct message_queue * q = NULL;
 	while (!m->quit) {
-		q = skynet_context_message_dispatch(sm, q, weight);
+		q = skynet_context_message_dispatch(sm, q);
 		if (q == NULL) {
-			if (pthread_mutex_lock(&m->mutex) == 0) {
-				++ m->sleep;
-				// "spurious wakeup" is harmless,
-				// because skynet_context_message_dispatch() can be call at any time.
-				if (!m->quit)
-					pthread_cond_wait(&m->cond, &m->mutex);
-				-- m->sleep;
-				if (pthread_mutex_unlock(&m->mutex)) {
-					fprintf(stderr, "unlock mutex error");
-					exit(1);
-				}
-			}
+			// spin and park, "spurious wakeup" is harmless,
+			// because skynet_context_message_dispatch() can be call at any time.
+			skynet_schedtrace(SCHEDTRACE_WAIT, SCHEDTRACE_BEGIN, 0);
+			q = skynet_globalmq_wait();
+			skynet_schedtrace(SCHEDTRACE_WAIT, SCHEDTRACE_END, 0);
 		}
 	}
 	return NULL;
 }
 
 static void
-start(int thread) {
-	pthread_t pid[thread+3];
+start(int thread, int tickless, int slice, struct thread_layout *layout) {
+	int socket = skynet_socket_thread();
+	pthread_t pid[thread+2+socket];
 
 	struct monitor *m = skynet_malloc(sizeof(*m));
 	memset(m, 0, sizeof(*m));
 	m->count = thread;
-	m->sleep = 0;
+	m->tickless = tickless;
+	m->slice = slice;
 
 	m->m = skynet_malloc(thread * sizeof(struct skynet_monitor *));
 	int i;
 	for (i=0;i<thread;i++) {
-		m->m[i] = skynet_monitor_new();
+		m->m[i] = skynet_monitor_new(layout->node[i]);
 	}
-	if (pthread_mutex_init(&m->mutex, NULL)) {
-		fprintf(stderr, "Init mutex error");
-		exit(1);
+	create_thread(&pid[0], thread_monitor, m, -1);
+	create_thread(&pid[1], thread_timer, m, layout->timer);
+	struct worker_parm sp[socket];
+	for (i=0;i<socket;i++) {
+		sp[i].m = m;
+		sp[i].id = i;
+		create_thread(&pid[i+2], thread_socket, &sp[i], i < layout->socket_n ? layout->socket[i] : -1);
 	}
-	if (pthread_cond_init(&m->cond, NULL)) {
-		fprintf(stderr, "Init cond error");
-		exit(1);
-	}
-
-	create_thread(&pid[0], thread_monitor, m);
-	create_thread(&pid[1], thread_timer, m);
-	create_thread(&pid[2], thread_socket, m);
 
-	static int weight[] = { 
-		-1, -1, -1, -1, 0, 0, 0, 0,
-		1, 1, 1, 1, 1, 1, 1, 1, 
-		2, 2, 2, 2, 2, 2, 2, 2, 
-		3, 3, 3, 3, 3, 3, 3, 3, };
 	struct worker_parm wp[thread];
 	for (i=0;i<thread;i++) {
 		wp[i].m = m;
 		wp[i].id = i;
-		if (i < sizeof(weight)/sizeof(weight[0])) {
-			wp[i].weight= weight[i];
-		} else {
-			wp[i].weight = 0;
-		}
-		create_thread(&pid[i+3], thread_worker, &wp[i]);
+		create_thread(&pid[i+2+socket], thread_worker, &wp[i], layout->worker[i]);
 	}
 
-	for (i=0;i<thread+3;i++) {
+	for (i=0;i<thread+2+socket;i++) {
 		pthread_join(pid[i], NULL); 
 	}
 
 	free_monitor(m);
 }
 
+static int
+worker_total(struct skynet_config *config) {
+	int i;
+	int thread = 0;
+	for (i=0;i<config->pools;i++) {
+		thread += config->pool_thread[i];
+	}
+	return thread;
+}
+
+// return -1 (no affinity) if the cpu in config is out of range
+static int
+layout_cpu(const char *key, int cpu) {
+	if (cpu >= 0 && !skynet_affinity_valid(cpu)) {
+		fprintf(stderr, "Invalid %s %d (not an available cpu), no affinity\n", key, cpu);
+		return -1;
+	}
+	return cpu;
+}
+
+static int
+layout_socket(struct thread_layout *layout, int cpu) {
+	int i;
+	for (i=0;i<layout->socket_n;i++) {
+		if (layout->socket[i] == cpu)
+			return 1;
+	}
+	return 0;
+}
+
+static void
+layout_init(struct thread_layout *layout, struct skynet_config *config) {
+	int thread = worker_total(config);
+	int i,j;
+	layout->timer = layout_cpu("timer_cpu", config->timer_cpu);
+	for (i=0;i<layout->socket_n;i++) {
+		layout->socket[i] = -1;
+	}
+	for (i=0;i<thread;i++) {
+		layout->worker[i] = -1;
+		layout->node[i] = -1;
+	}
+	if (config->socket_cpu) {
+		// one cpu for each socket thread, the socket threads out of the list have no affinity
+		int cpus[CPU_LIST_MAX];
+		int n = skynet_affinity_parse(config->socket_cpu, cpus, CPU_LIST_MAX);
+		if (n < 0) {
+			fprintf(stderr, "Invalid socket_cpu : %s\n", config->socket_cpu);
+			exit(1);
+		}
+		for (i=0;i<n && i<layout->socket_n;i++) {
+			layout->socket[i] = layout_cpu("cpu in socket_cpu", cpus[i]);
+		}
+	}
+	if (config->worker_cpu == NULL)
+		return;
+	int cpus[CPU_LIST_MAX];
+	int n = skynet_affinity_parse(config->worker_cpu, cpus, CPU_LIST_MAX);
+	if (n < 0) {
+		fprintf(stderr, "Invalid worker_cpu : %s\n", config->worker_cpu);
+		exit(1);
+	}
+	// socket thread and timer thread have dedicated cpus
+	int valid = 0;
+	j = 0;
+	for (i=0;i<n;i++) {
+		if (layout_cpu("cpu in worker_cpu", cpus[i]) < 0)
+			continue;
+		++valid;
+		if (!layout_socket(layout, cpus[i]) && cpus[i] != layout->timer) {
+			cpus[j++] = cpus[i];
+		}
+	}
+	if (valid == 0) {
+		// the workers run without affinity
+		return;
+	}
+	n = j;
+	if (n == 0) {
+		fprintf(stderr, "No cpu for worker in worker_cpu : %s\n", config->worker_cpu);
+		exit(1);
+	}
+	for (i=0;i<thread;i++) {
+		layout->worker[i] = cpus[i % n];
+		layout->node[i] = skynet_affinity_node(layout->worker[i]);
+	}
+}
+
+static void
+layout_report(struct thread_layout *layout, struct skynet_config *config) {
+	int thread = worker_total(config);
+	int socket = skynet_socket_thread();
+	skynet_error(NULL, "Thread layout : %d workers, %d socket threads, timer cpu %d (-1 means any cpu)",
+		thread, socket, layout->timer);
+	int i;
+	for (i=0;i<socket && i<layout->socket_n;i++) {
+		if (layout->socket[i] >= 0) {
+			skynet_error(NULL, "Thread layout : socket %d cpu %d", i, layout->socket[i]);
+		}
+	}
+	if (config->pools > 1) {
+		int first = 0;
+		for (i=0;i<config->pools;i++) {
+			skynet_error(NULL, "Thread layout : pool %s worker %d-%d",
+				config->pool_name[i], first, first + config->pool_thread[i] - 1);
+			first += config->pool_thread[i];
+		}
+	}
+	for (i=0;i<thread;i++) {
+		if (layout->worker[i] >= 0) {
+			skynet_error(NULL, "Thread layout : worker %d cpu %d node %d", i, layout->worker[i], layout->node[i]);
+		}
+	}
+}
+
 static void
 bootstrap(struct skynet_context * logger, const char * cmdline) {
 	int sz = strlen(cmdline);
 	char name[sz+1];
 	char args[sz+1];
 	sscanf(cmdline, "%s %s", name, args);
-	struct skynet_context *ctx = skynet_context_new(name, args);
+	struct skynet_context *ctx = skynet_context_new(name, args, 0);
 	if (ctx == NULL) {
 		skynet_error(NULL, "Bootstrap error : %s\n", cmdline);
 		skynet_context_dispatchall(logger);
@@ -258,23 +388,46 @@ skynet_start(struct skynet_config * config) {
 			exit(1);
 		}
 	}
+	skynet_schedtrace_init();
 	skynet_harbor_init(config->harbor);
 	skynet_handle_init(config->harbor);
-	skynet_mq_init();
+
+	int thread = worker_total(config);
+	int worker_cpu[thread];
+	int worker_node[thread];
+	// socket_server_create() clamps socket_thread to [1, MAX_SHARD], so it has no more threads than socket_n
+	int socket_n = config->socket_thread > 1 ? config->socket_thread : 1;
+	int socket_cpu[socket_n];
+	struct thread_layout layout = { socket_n, socket_cpu, -1, worker_cpu, worker_node };
+	layout_init(&layout, config);
+
+	skynet_mq_init(config->pools, config->pool_name, config->pool_thread, worker_node);
 	skynet_module_init(config->module_path);
-	skynet_timer_init();
-	skynet_socket_init();
+	skynet_timer_init(config->timer_resolution);
+	skynet_timer_coalesce(config->timer_coalesce);
+	if (config->time_slice < 0 || config->time_slice > MAX_TIME_SLICE) {
+		int slice = config->time_slice < 0 ? 0 : MAX_TIME_SLICE;
+		fprintf(stderr, "time_slice %d is out of range [0, %d], use %d\n", config->time_slice, MAX_TIME_SLICE, slice);
+		config->time_slice = slice;
+	}
+	skynet_monitor_timeslice(config->time_slice);
+	int tickless = config->timer_tickless && skynet_timer_tickless();
+	skynet_socket_init(config->socket_thread);
 	skynet_profile_enable(config->profile);
+	skynet_latency_enable(config->latency);
+	skynet_dispatch_budget(config->dispatch_budget);
 
-	struct skynet_context *ctx = skynet_context_new(config->logservice, config->logger);
+	struct skynet_context *ctx = skynet_context_new(config->logservice, config->logger, 0);
 	if (ctx == NULL) {
 		fprintf(stderr, "Can't launch %s service\n", config->logservice);
 		exit(1);
 	}
 
+	layout_report(&layout, config);
+
 	bootstrap(ctx, config->bootstrap);
 
-	start(config->thread);
+	start(thread, tickless, config->time_slice, &layout);
 
 	// harbor_exit may call socket send, so it should exit before socket_free
 	skynet_harbor_exit();
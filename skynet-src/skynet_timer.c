@@ -5,12 +5,14 @@
 #include "skynet_server.h"
 #include "skynet_handle.h"
 #include "spinlock.h"
+#include "atomic.h"
 
 #include <time.h>
 #include <assert.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <stdio.h>
 
 #if defined(__APPLE__)
 #include <AvailabilityMacros.h>
@@ -19,7 +21,12 @@
 #include <mach/mach.h>
 #endif
 
-typedef void (*timer_execute_func)(void *ud,void *arg);
+#if defined(__linux__)
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include <errno.h>
+#define HAVE_TIMERFD
+#endif
 
 #define TIME_NEAR_SHIFT 8
 #define TIME_NEAR (1 << TIME_NEAR_SHIFT)
@@ -27,48 +34,145 @@ typedef void (*timer_execute_func)(void *ud,void *arg);
 #define TIME_LEVEL (1 << TIME_LEVEL_SHIFT)
 #define TIME_NEAR_MASK (TIME_NEAR-1)
 #define TIME_LEVEL_MASK (TIME_LEVEL-1)
+#define DEFAULT_HASH_SIZE 1024
+#define TICKLESS_MAX 1000	// in millisecond, the timer thread wakes up at least once a second in tickless mode
+#define DEFAULT_RESOLUTION 10	// in millisecond, a tick of the wheel
 
 struct timer_event {
 	uint32_t handle;
 	int session;
+	int coalesce;
 };
 
+// the wheel lists are circular with a sentinel head, so a node can unlink itself in O(1)
 struct timer_node {
 	struct timer_node *next;
+	struct timer_node *prev;
+	struct timer_node *hash_next;	// (handle, session) index for cancel
 	uint32_t expire;
+	struct timer_event event;
 };
 
 struct link_list {
 	struct timer_node head;
-	struct timer_node *tail;
 };
 
 struct timer {
 	struct link_list near[TIME_NEAR];
 	struct link_list t[4][TIME_LEVEL];
 	struct spinlock lock;
+	struct timer_node * staging;	// nodes added by the workers without lock, see timer_merge()
+	struct timer_node **hash;
+	int hash_size;
+	int hash_count;
+	int coalesce;	// coalesce the expired events of a service in one tick into one message
+	struct timer_node **expired;	// only used by the timer thread in dispatch_list
+	int expired_cap;
+	int tickless_fd;	// timerfd of tickless mode, or -1
+	uint32_t wakeup;	// the tick the timer thread sleeps until in tickless mode
+	uint64_t origin;	// current - current_point, skynet_now() reads the clock in tickless mode
+	uint32_t offset;	// (uint32_t)current_point - time, timer_add() reads the clock in tickless mode
 	uint32_t time;
 	uint32_t starttime;
-	uint64_t current;
-	uint64_t current_point;
+	uint64_t current;	// in ticks, skynet_now() converts it to centisecond
+	uint64_t current_point;	// in ticks
+	int resolution;	// millisecond of a tick, 10 (centisecond) by default
+	int tick_per_cs;
 };
 
 static struct timer * TI = NULL;
 
+static uint64_t gettime();
+
+static inline void
+link_init(struct link_list *list) {
+	list->head.next = &(list->head);
+	list->head.prev = &(list->head);
+}
+
+static inline int
+link_empty(struct link_list *list) {
+	return list->head.next == &(list->head);
+}
+
+// detach all the nodes, return them as a NULL terminated chain
 static inline struct timer_node *
 link_clear(struct link_list *list) {
+	if (link_empty(list))
+		return NULL;
 	struct timer_node * ret = list->head.next;
-	list->head.next = 0;
-	list->tail = &(list->head);
+	list->head.prev->next = NULL;
+	link_init(list);
 
 	return ret;
 }
 
 static inline void
-link(struct link_list *list,struct timer_node *node) {
-	list->tail->next = node;
-	list->tail = node;
-	node->next=0;
+link_node(struct link_list *list,struct timer_node *node) {
+	struct timer_node *tail = list->head.prev;
+	node->prev = tail;
+	node->next = &(list->head);
+	tail->next = node;
+	list->head.prev = node;
+}
+
+static inline void
+unlink_node(struct timer_node *node) {
+	node->prev->next = node->next;
+	node->next->prev = node->prev;
+}
+
+static inline uint32_t
+hash_event(struct timer_event *event) {
+	return event->handle ^ ((uint32_t)event->session * 2654435761u);
+}
+
+static void
+hash_expand(struct timer *T) {
+	int size = T->hash_size * 2;
+	struct timer_node **hash = skynet_malloc(size * sizeof(*hash));
+	memset(hash, 0, size * sizeof(*hash));
+	int i;
+	for (i=0;i<T->hash_size;i++) {
+		struct timer_node *node = T->hash[i];
+		while (node) {
+			struct timer_node *next = node->hash_next;
+			uint32_t h = hash_event(&node->event) & (size-1);
+			node->hash_next = hash[h];
+			hash[h] = node;
+			node = next;
+		}
+	}
+	skynet_free(T->hash);
+	T->hash = hash;
+	T->hash_size = size;
+}
+
+static void
+hash_insert(struct timer *T, struct timer_node *node) {
+	if (T->hash_count >= T->hash_size) {
+		hash_expand(T);
+	}
+	uint32_t h = hash_event(&node->event) & (T->hash_size-1);
+	node->hash_next = T->hash[h];
+	T->hash[h] = node;
+	++T->hash_count;
+}
+
+static struct timer_node *
+hash_remove(struct timer *T, uint32_t handle, int session) {
+	struct timer_event key = { .handle = handle, .session = session };
+	struct timer_node **pnode = &T->hash[hash_event(&key) & (T->hash_size-1)];
+	struct timer_node *node;
+	while ((node = *pnode)) {
+		if (node->event.handle == handle && node->event.session == session) {
+			*pnode = node->hash_next;
+			--T->hash_count;
+			return node;
+		}
+		pnode = &node->hash_next;
+	}
+	return NULL;
 }
 
 static void
@@ -77,7 +181,7 @@ add_node(struct timer *T,struct timer_node *node) {
 	uint32_t current_time=T->time;
 	
 	if ((time|TIME_NEAR_MASK)==(current_time|TIME_NEAR_MASK)) {
-		link(&T->near[time&TIME_NEAR_MASK],node);
+		link_node(&T->near[time&TIME_NEAR_MASK],node);
 	} else {
 		int i;
 		uint32_t mask=TIME_NEAR << TIME_LEVEL_SHIFT;
@@ -88,21 +192,126 @@ add_node(struct timer *T,struct timer_node *node) {
 			mask <<= TIME_LEVEL_SHIFT;
 		}
 
-		link(&T->t[i][((time>>(TIME_NEAR_SHIFT + i*TIME_LEVEL_SHIFT)) & TIME_LEVEL_MASK)],node);	
+		link_node(&T->t[i][((time>>(TIME_NEAR_SHIFT + i*TIME_LEVEL_SHIFT)) & TIME_LEVEL_MASK)],node);	
+	}
+}
+
+// the tick of wheel at the clock now. T->time is stale while the timer thread sleeps in tickless mode,
+// and it catches up with current_point tick by tick in skynet_updatetime()
+static inline uint32_t
+tickless_time(struct timer *T, uint64_t now) {
+	return (uint32_t)now - ATOM_LOAD(&T->offset);
+}
+
+// arm the timerfd at the tick expire, the lock of T must be held
+static void
+tickless_arm(struct timer *T, uint32_t expire) {
+#ifdef HAVE_TIMERFD
+	ATOM_STORE(&T->wakeup, expire);
+	// gettime() is CLOCK_MONOTONIC in ticks, expire may be passed already
+	uint64_t now = gettime();
+	uint64_t ms = (now + (int32_t)(expire - tickless_time(T, now))) * T->resolution;
+	struct itimerspec ts;
+	memset(&ts, 0, sizeof(ts));
+	ts.it_value.tv_sec = ms / 1000;
+	ts.it_value.tv_nsec = (ms % 1000) * 1000000;
+	timerfd_settime(T->tickless_fd, TFD_TIMER_ABSTIME, &ts, NULL);
+#endif
+}
+
+// ticks to the next time the wheel has something to do, at most TICKLESS_MAX
+static uint32_t
+tickless_next(struct timer *T) {
+	uint32_t max = TICKLESS_MAX / T->resolution;
+	if (T->hash_count == 0)
+		return max;
+	uint32_t current = T->time & TIME_NEAR_MASK;
+	uint32_t i;
+	for (i=current+1;i<TIME_NEAR && i-current<max;i++) {
+		if (!link_empty(&T->near[i])) {
+			return i-current;
+		}
+	}
+	// the nodes of the levels move down to near at the end of near window
+	uint32_t delta = TIME_NEAR - current;
+	return delta < max ? delta : max;
+}
+
+// move the staging nodes into the wheel, the lock of T must be held
+static void
+timer_merge(struct timer *T) {
+	struct timer_node *list;
+	// CAS is a full barrier even if staging is empty, skynet_timer_wait() depends on it
+	do {
+		list = T->staging;
+	} while (!ATOM_CAS_POINTER(&T->staging, list, NULL));
+	// staging is a stack, reverse it to keep the order of adding
+	struct timer_node *node = NULL;
+	while (list) {
+		struct timer_node *next = list->next;
+		list->next = node;
+		node = list;
+		list = next;
+	}
+	while (node) {
+		struct timer_node *next = node->next;
+		if ((int32_t)(node->expire - T->time) <= 0) {
+			// T->time moved on after adding, dispatch it at the next tick.
+			// not near[T->time], tickless_next() doesn't look at the current slot
+			link_node(&T->near[(T->time + 1) & TIME_NEAR_MASK], node);
+		} else {
+			add_node(T,node);
+		}
+		hash_insert(T,node);
+		node = next;
 	}
 }
 
+// lock free, a few atomic operations without T->lock
 static void
-timer_add(struct timer *T,void *arg,size_t sz,int time) {
-	struct timer_node *node = (struct timer_node *)skynet_malloc(sizeof(*node)+sz);
-	memcpy(node+1,arg,sz);
+timer_add(struct timer *T,struct timer_event *event,int time) {
+	struct timer_node *node = (struct timer_node *)skynet_malloc(sizeof(*node));
+	node->event = *event;
+	// T->time may be behind the clock up to TICKLESS_MAX in tickless mode
+	uint32_t current = T->tickless_fd >= 0 ? tickless_time(T, gettime()) : ATOM_LOAD(&T->time);
+	uint32_t expire = time + current;
+	node->expire = expire;
+
+	struct timer_node *head;
+	do {
+		head = T->staging;
+		node->next = head;
+	} while (!ATOM_CAS_POINTER(&T->staging, head, node));
+	// node may be sent and freed by the timer thread since now
+
+	if (T->tickless_fd >= 0 && (int32_t)(expire - ATOM_LOAD(&T->wakeup)) < 0) {
+		// wake up the timer thread earlier (rare)
+		SPIN_LOCK(T);
+			timer_merge(T);
+			if ((int32_t)(expire - T->wakeup) < 0) {
+				tickless_arm(T, expire);
+			}
+		SPIN_UNLOCK(T);
+	}
+}
 
+static int
+timer_cancel(struct timer *T, uint32_t handle, int session) {
 	SPIN_LOCK(T);
 
-		node->expire=time+T->time;
-		add_node(T,node);
+		// the node may be in staging yet
+		timer_merge(T);
+		struct timer_node *node = hash_remove(T, handle, session);
+		if (node) {
+			unlink_node(node);
+		}
 
 	SPIN_UNLOCK(T);
+
+	if (node == NULL)
+		return 0;
+	skynet_free(node);
+	return 1;
 }
 
 static void
@@ -118,7 +327,8 @@ move_list(struct timer *T, int level, int idx) {
 static void
 timer_shift(struct timer *T) {
 	int mask = TIME_NEAR;
-	uint32_t ct = ++T->time;
+	uint32_t ct = T->time + 1;
+	ATOM_STORE(&T->time, ct);
 	if (ct == 0) {
 		move_list(T, 3, 0);
 	} else {
@@ -139,16 +349,89 @@ timer_shift(struct timer *T) {
 }
 
 static inline void
-dispatch_list(struct timer_node *current) {
-	do {
-		struct timer_event * event = (struct timer_event *)(current+1);
-		struct skynet_message message;
-		message.source = 0;
-		message.session = event->session;
-		message.data = NULL;
-		message.sz = (size_t)PTYPE_RESPONSE << MESSAGE_TYPE_SHIFT;
+dispatch_event(struct timer_event *event) {
+	struct skynet_message message;
+	message.source = 0;
+	message.session = event->session;
+	message.data = NULL;
+	message.sz = (size_t)PTYPE_RESPONSE << MESSAGE_TYPE_SHIFT;
+
+	skynet_context_push(event->handle, &message);
+}
+
+static int
+compare_node(const void *a, const void *b) {
+	const struct timer_node *na = *(const struct timer_node **)a;
+	const struct timer_node *nb = *(const struct timer_node **)b;
+	if (na->event.handle != nb->event.handle)
+		return na->event.handle < nb->event.handle ? -1 : 1;
+	// keep the order of sessions
+	return na->event.session < nb->event.session ? -1 : (na->event.session > nb->event.session);
+}
+
+// send sessions of expired[0..n) (the same handle) in one message
+static void
+dispatch_group(struct timer_node **expired, int n) {
+	if (n == 1) {
+		dispatch_event(&expired[0]->event);
+		return;
+	}
+	int *session = skynet_malloc(n * sizeof(int));
+	int i;
+	for (i=0;i<n;i++) {
+		session[i] = expired[i]->event.session;
+	}
+	struct skynet_message message;
+	message.source = 0;
+	message.session = 0;
+	message.data = session;
+	message.sz = (n * sizeof(int)) | (size_t)PTYPE_RESPONSE << MESSAGE_TYPE_SHIFT;
+
+	if (skynet_context_push(expired[0]->event.handle, &message)) {
+		skynet_free(session);
+	}
+}
+
+static void
+dispatch_coalesce(struct timer *T, struct timer_node *current) {
+	int n = 0;
+	while (current) {
+		struct timer_node * temp = current;
+		current=current->next;
+		if (!temp->event.coalesce) {
+			dispatch_event(&temp->event);
+			skynet_free(temp);
+			continue;
+		}
+		if (n >= T->expired_cap) {
+			T->expired_cap = T->expired_cap ? T->expired_cap * 2 : TIME_NEAR;
+			T->expired = skynet_realloc(T->expired, T->expired_cap * sizeof(struct timer_node *));
+		}
+		T->expired[n++] = temp;
+	}
+	if (n == 0)
+		return;
+	qsort(T->expired, n, sizeof(struct timer_node *), compare_node);
+	int i, begin = 0;
+	for (i=1;i<=n;i++) {
+		if (i == n || T->expired[i]->event.handle != T->expired[begin]->event.handle) {
+			dispatch_group(T->expired + begin, i - begin);
+			begin = i;
+		}
+	}
+	for (i=0;i<n;i++) {
+		skynet_free(T->expired[i]);
+	}
+}
 
-		skynet_context_push(event->handle, &message);
+static inline void
+dispatch_list(struct timer *T, struct timer_node *current) {
+	if (T->coalesce && current->next) {
+		dispatch_coalesce(T, current);
+		return;
+	}
+	do {
+		dispatch_event(&current->event);
 		
 		struct timer_node * temp = current;
 		current=current->next;
@@ -160,11 +443,16 @@ static inline void
 timer_execute(struct timer *T) {
 	int idx = T->time & TIME_NEAR_MASK;
 	
-	while (T->near[idx].head.next) {
+	while (!link_empty(&T->near[idx])) {
 		struct timer_node *current = link_clear(&T->near[idx]);
+		// the nodes can't be cancelled after this point, they are sending
+		struct timer_node *node;
+		for (node = current; node; node = node->next) {
+			hash_remove(T, node->event.handle, node->event.session);
+		}
 		SPIN_UNLOCK(T);
 		// dispatch_list don't need lock T
-		dispatch_list(current);
+		dispatch_list(T, current);
 		SPIN_LOCK(T);
 	}
 }
@@ -173,6 +461,8 @@ static void
 timer_update(struct timer *T) {
 	SPIN_LOCK(T);
 
+	timer_merge(T);
+
 	// try to dispatch timeout 0 (rare condition)
 	timer_execute(T);
 
@@ -192,24 +482,29 @@ timer_create_timer() {
 	int i,j;
 
 	for (i=0;i<TIME_NEAR;i++) {
-		link_clear(&r->near[i]);
+		link_init(&r->near[i]);
 	}
 
 	for (i=0;i<4;i++) {
 		for (j=0;j<TIME_LEVEL;j++) {
-			link_clear(&r->t[i][j]);
+			link_init(&r->t[i][j]);
 		}
 	}
 
+	r->hash_size = DEFAULT_HASH_SIZE;
+	r->hash = skynet_malloc(r->hash_size * sizeof(struct timer_node *));
+	memset(r->hash, 0, r->hash_size * sizeof(struct timer_node *));
+
 	SPIN_INIT(r)
 
 	r->current = 0;
+	r->tickless_fd = -1;
 
 	return r;
 }
 
-int
-skynet_timeout(uint32_t handle, int time, int session) {
+static int
+timeout_tick(uint32_t handle, int64_t time, int session, int coalesce) {
 	if (time <= 0) {
 		struct skynet_message message;
 		message.source = 0;
@@ -224,12 +519,35 @@ skynet_timeout(uint32_t handle, int time, int session) {
 		struct timer_event event;
 		event.handle = handle;
 		event.session = session;
-		timer_add(TI, &event, sizeof(event), time);
+		event.coalesce = coalesce;
+		if (time > INT32_MAX) {
+			// expire is compared as int32_t, about 24.8 days at 1ms resolution
+			skynet_error(NULL, "timeout of :%08x is too long (%lld ticks), clamped to %d ticks", handle, (long long)time, INT32_MAX);
+			time = INT32_MAX;
+		}
+		timer_add(TI, &event, (int)time);
 	}
 
 	return session;
 }
 
+int
+skynet_timeout(uint32_t handle, int time, int session, int coalesce) {
+	return timeout_tick(handle, (int64_t)time * TI->tick_per_cs, session, coalesce);
+}
+
+int
+skynet_timeout_ms(uint32_t handle, int ms, int session, int coalesce) {
+	// round up to a tick
+	int64_t tick = ms <= 0 ? 0 : ((int64_t)ms + TI->resolution - 1) / TI->resolution;
+	return timeout_tick(handle, tick, session, coalesce);
+}
+
+int
+skynet_timer_cancel(uint32_t handle, int session) {
+	return timer_cancel(TI, handle, session);
+}
+
 // centisecond: 1/100 second
 static void
 systime(uint32_t *sec, uint32_t *cs) {
@@ -246,19 +564,21 @@ systime(uint32_t *sec, uint32_t *cs) {
 #endif
 }
 
+// in ticks (TI->resolution millisecond)
 static uint64_t
 gettime() {
 	uint64_t t;
+	int resolution = TI->resolution;
 #if !defined(__APPLE__) || defined(AVAILABLE_MAC_OS_X_VERSION_10_12_AND_LATER)
 	struct timespec ti;
 	clock_gettime(CLOCK_MONOTONIC, &ti);
-	t = (uint64_t)ti.tv_sec * 100;
-	t += ti.tv_nsec / 10000000;
+	t = (uint64_t)ti.tv_sec * (1000 / resolution);
+	t += ti.tv_nsec / (1000000 * resolution);
 #else
 	struct timeval tv;
 	gettimeofday(&tv, NULL);
-	t = (uint64_t)tv.tv_sec * 100;
-	t += tv.tv_usec / 10000;
+	t = (uint64_t)tv.tv_sec * (1000 / resolution);
+	t += tv.tv_usec / (1000 * resolution);
 #endif
 	return t;
 }
@@ -269,6 +589,8 @@ skynet_updatetime(void) {
 	if(cp < TI->current_point) {
 		skynet_error(NULL, "time diff error: change from %lld to %lld", cp, TI->current_point);
 		TI->current_point = cp;
+		TI->origin = TI->current - cp;
+		ATOM_STORE(&TI->offset, (uint32_t)cp - TI->time);
 	} else if (cp != TI->current_point) {
 		uint32_t diff = (uint32_t)(cp - TI->current_point);
 		TI->current_point = cp;
@@ -287,16 +609,72 @@ skynet_starttime(void) {
 
 uint64_t 
 skynet_now(void) {
-	return TI->current;
+	if (TI->tickless_fd >= 0) {
+		// TI->current may be stale while the timer thread sleeps
+		return (TI->origin + gettime()) / TI->tick_per_cs;
+	}
+	return TI->current / TI->tick_per_cs;
+}
+
+int
+skynet_timer_resolution(void) {
+	return TI->resolution;
+}
+
+int
+skynet_timer_tickless(void) {
+#ifdef HAVE_TIMERFD
+	int fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+	if (fd < 0) {
+		fprintf(stderr, "timerfd_create failed, tickless timer is off\n");
+		return 0;
+	}
+	TI->tickless_fd = fd;
+	return 1;
+#else
+	fprintf(stderr, "tickless timer is not supported on this platform\n");
+	return 0;
+#endif
+}
+
+void
+skynet_timer_wait(void) {
+#ifdef HAVE_TIMERFD
+	struct timer *T = TI;
+	SPIN_LOCK(T);
+		// publish the wakeup tick before merging, so timer_add() either
+		// sees it and arms the timerfd itself, or its node is merged here.
+		ATOM_STORE(&T->wakeup, T->time + tickless_next(T));
+		timer_merge(T);
+		tickless_arm(T, T->time + tickless_next(T));
+	SPIN_UNLOCK(T);
+	uint64_t expirations;
+	if (read(T->tickless_fd, &expirations, sizeof(expirations)) < 0 && errno != EINTR) {
+		skynet_error(NULL, "read timerfd failed : %s", strerror(errno));
+	}
+#endif
+}
+
+void
+skynet_timer_coalesce(int enable) {
+	TI->coalesce = enable;
 }
 
 void 
-skynet_timer_init(void) {
+skynet_timer_init(int resolution) {
 	TI = timer_create_timer();
+	if (resolution <= 0 || 10 % resolution != 0) {
+		fprintf(stderr, "Invalid timer resolution %d ms (should be 1, 2, 5 or 10), use %d ms\n", resolution, DEFAULT_RESOLUTION);
+		resolution = DEFAULT_RESOLUTION;
+	}
+	TI->resolution = resolution;
+	TI->tick_per_cs = 10 / resolution;
 	uint32_t current = 0;
 	systime(&TI->starttime, &current);
-	TI->current = current;
+	TI->current = (uint64_t)current * TI->tick_per_cs;
 	TI->current_point = gettime();
+	TI->origin = TI->current - TI->current_point;
+	TI->offset = (uint32_t)TI->current_point;
 }
 
 // for profile
@@ -304,6 +682,19 @@ skynet_timer_init(void) {
 #define NANOSEC 1000000000
 #define MICROSEC 1000000
 
+uint64_t
+skynet_monotonic_time(void) {
+#if !defined(__APPLE__) || defined(AVAILABLE_MAC_OS_X_VERSION_10_12_AND_LATER)
+	struct timespec ti;
+	clock_gettime(CLOCK_MONOTONIC, &ti);
+	return (uint64_t)ti.tv_sec * MICROSEC + (uint64_t)ti.tv_nsec / (NANOSEC / MICROSEC);
+#else
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (uint64_t)tv.tv_sec * MICROSEC + (uint64_t)tv.tv_usec;
+#endif
+}
+
 uint64_t
 skynet_thread_time(void) {
 #if  !defined(__APPLE__) || defined(AVAILABLE_MAC_OS_X_VERSION_10_12_AND_LATER)
@@ -3,11 +3,21 @@
 
 #include <stdint.h>
 
-int skynet_timeout(uint32_t handle, int time, int session);
+// coalesce : the service accepts the coalesced timeout message (PTYPE_RESPONSE with session 0, data is an array of sessions)
+int skynet_timeout(uint32_t handle, int time, int session, int coalesce);	// time in centisecond
+int skynet_timeout_ms(uint32_t handle, int ms, int session, int coalesce);	// rounded up to the timer resolution
+int skynet_timer_cancel(uint32_t handle, int session);	// return 0 if the timer is already sent
 void skynet_updatetime(void);
 uint32_t skynet_starttime(void);
 uint64_t skynet_thread_time(void);	// for profile, in micro second
+uint64_t skynet_monotonic_time(void);	// for latency stat, in micro second
 
-void skynet_timer_init(void);
+// resolution : millisecond of a tick of the wheel, 1, 2, 5 or 10 (default, centisecond)
+void skynet_timer_init(int resolution);
+int skynet_timer_resolution(void);
+void skynet_timer_coalesce(int enable);
+// tickless mode : the timer thread sleeps on a timerfd until the next expiry instead of a fixed tick, return 0 if unsupported
+int skynet_timer_tickless(void);
+void skynet_timer_wait(void);	// sleep until the next expiry (tickless mode only)
 
 #endif
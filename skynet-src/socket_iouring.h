@@ -0,0 +1,520 @@
+#ifndef poll_socket_iouring_h
+#define poll_socket_iouring_h
+
+// io_uring backend (linux 5.5+), build with -DUSE_IOURING (needs the kernel headers of linux 5.19+).
+// The data of the stream sockets (see sp_recv) is received by IORING_OP_RECV, which picks a buffer from
+// the provided buffer ring (linux 5.19+), and comes with the read event. The socket server copies the data
+// out and gives the buffer back by sp_recv_done, so the small reads cost no syscall at all. When a buffer
+// is filled up, the socket server reads the rest itself, as the poll backends do, and resumes the recv.
+// The other sockets (listen, udp, connecting, and the write interest of all) have a one-shot
+// IORING_OP_POLL_ADD in flight, which is armed again after it completes, so it works like level-triggered epoll.
+// The requests are only queued in the submission ring, and submitted by the io_uring_enter of next sp_wait,
+// which waits for the completions in the same syscall.
+// All the sp_* functions must be called by the poll thread only.
+
+#include <netdb.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <linux/io_uring.h>
+
+#define URING_ENTRIES 4096
+#define URING_CQ_ENTRIES 16384
+// URING_BUF_COUNT must be power of 2
+#define URING_BUF_COUNT 512
+#define URING_BUF_SIZE 4096
+#define URING_BUF_GROUP 0
+#define URING_CANCEL ((uint64_t)-1)	// user_data of the cancel requests
+
+#define URING_OP_POLL 0
+#define URING_OP_RECV 1
+
+// The user_data of request is (gen << 32 | op << 31 | fd), gen changes when the fd's interest changes,
+// so the completions of old requests are ignored.
+struct uring_poll {
+	void *ud;
+	uint32_t gen;	// generation of poll request
+	uint32_t rgen;	// generation of recv request
+	uint32_t events;	// 0 : not in the poll
+	int starved_next;	// next fd in the starved list
+	bool armed;	// poll request in flight
+	bool recv;	// receive the data by recv request instead of polling POLLIN
+	bool recving;	// recv request in flight
+	bool starved;	// in the starved list, waiting for a free buffer
+};
+
+struct uring {
+	int fd;
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned sq_mask;
+	unsigned *sq_array;
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	unsigned sq_entries;
+	unsigned sq_local;	// local sq tail
+	unsigned pending;	// sqes not submitted
+	void *sq_ring;
+	size_t sq_ring_sz;
+	void *cq_ring;
+	size_t cq_ring_sz;
+	size_t sqes_sz;
+	int poll_n;
+	struct uring_poll *poll;	// index by fd
+	struct io_uring_buf_ring *br;	// provided buffer ring, NULL if the kernel doesn't support it
+	char *buf;	// URING_BUF_COUNT buffers of URING_BUF_SIZE
+	unsigned short br_tail;
+	int starved;	// fds whose recv request failed for no buffer (-1 for empty)
+	int starved_tail;
+};
+
+static int
+uring_enter(struct uring *u, unsigned submit, unsigned wait, unsigned flags) {
+	return (int)syscall(__NR_io_uring_enter, u->fd, submit, wait, flags, NULL, 0);
+}
+
+// submit the queued requests without waiting, when the submission ring is full
+static void
+uring_flush(struct uring *u) {
+	while (u->pending > 0) {
+		int n = uring_enter(u, u->pending, 0, 0);
+		if (n < 0) {
+			// no EBUSY without IORING_ENTER_GETEVENTS, the overflow of completion ring is kept by kernel (IORING_FEAT_NODROP)
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+			fprintf(stderr, "socket-server: io_uring submit error %s.\n", strerror(errno));
+			return;
+		}
+		u->pending -= n;
+	}
+}
+
+static struct io_uring_sqe *
+uring_sqe(struct uring *u) {
+	if (u->sq_local - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) >= u->sq_entries) {
+		uring_flush(u);
+	}
+	unsigned index = u->sq_local & u->sq_mask;
+	struct io_uring_sqe *sqe = &u->sqes[index];
+	memset(sqe, 0, sizeof(*sqe));
+	u->sq_array[index] = index;
+	++u->sq_local;
+	++u->pending;
+	return sqe;
+}
+
+// publish the sqes to kernel
+static inline void
+uring_commit(struct uring *u) {
+	__atomic_store_n(u->sq_tail, u->sq_local, __ATOMIC_RELEASE);
+}
+
+static inline uint64_t
+uring_data(int sock, uint32_t gen, int op) {
+	return (uint64_t)gen << 32 | (uint32_t)op << 31 | (uint32_t)sock;
+}
+
+static void
+uring_cancel(struct uring *u, uint8_t opcode, uint64_t data) {
+	struct io_uring_sqe *sqe = uring_sqe(u);
+	sqe->opcode = opcode;
+	sqe->fd = -1;
+	sqe->addr = data;
+	sqe->user_data = URING_CANCEL;
+	uring_commit(u);
+}
+
+// POLLIN is not polled for the sockets receive by recv request
+static inline uint32_t
+uring_events(struct uring_poll *p) {
+	return p->recv ? p->events & ~POLLIN : p->events;
+}
+
+static void
+uring_arm(struct uring *u, int sock) {
+	struct uring_poll *p = &u->poll[sock];
+	uint32_t events = uring_events(p);
+	if (events == 0)
+		return;
+	struct io_uring_sqe *sqe = uring_sqe(u);
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = sock;
+	sqe->poll32_events = events;
+	sqe->user_data = uring_data(sock, p->gen, URING_OP_POLL);
+	p->armed = true;
+	uring_commit(u);
+}
+
+static void
+uring_disarm(struct uring *u, int sock) {
+	struct uring_poll *p = &u->poll[sock];
+	if (p->armed) {
+		uring_cancel(u, IORING_OP_POLL_REMOVE, uring_data(sock, p->gen, URING_OP_POLL));
+		p->armed = false;
+	}
+	++p->gen;
+}
+
+static void
+uring_recv_arm(struct uring *u, int sock) {
+	struct uring_poll *p = &u->poll[sock];
+	struct io_uring_sqe *sqe = uring_sqe(u);
+	sqe->opcode = IORING_OP_RECV;
+	sqe->fd = sock;
+	sqe->len = URING_BUF_SIZE;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = URING_BUF_GROUP;
+	sqe->user_data = uring_data(sock, p->rgen, URING_OP_RECV);
+	p->recving = true;
+	uring_commit(u);
+}
+
+static void
+uring_recv_disarm(struct uring *u, int sock) {
+	struct uring_poll *p = &u->poll[sock];
+	if (p->recving) {
+		uring_cancel(u, IORING_OP_ASYNC_CANCEL, uring_data(sock, p->rgen, URING_OP_RECV));
+		p->recving = false;
+	}
+	p->recv = false;
+	++p->rgen;
+}
+
+// the recv request gets no buffer, try again after a buffer is given back
+static void
+uring_starve(struct uring *u, int sock) {
+	struct uring_poll *p = &u->poll[sock];
+	if (p->starved)
+		return;
+	p->starved = true;
+	p->starved_next = -1;
+	if (u->starved < 0) {
+		u->starved = sock;
+	} else {
+		u->poll[u->starved_tail].starved_next = sock;
+	}
+	u->starved_tail = sock;
+}
+
+static void
+uring_buf_put(struct uring *u, unsigned bid) {
+	struct io_uring_buf *b = &u->br->bufs[u->br_tail & (URING_BUF_COUNT - 1)];
+	b->addr = (uint64_t)(uintptr_t)(u->buf + (size_t)bid * URING_BUF_SIZE);
+	b->len = URING_BUF_SIZE;
+	b->bid = (uint16_t)bid;
+	++u->br_tail;
+	__atomic_store_n(&u->br->tail, u->br_tail, __ATOMIC_RELEASE);
+	// wake up a starved socket for this buffer, it may be removed already
+	while (u->starved >= 0) {
+		int sock = u->starved;
+		struct uring_poll *p = &u->poll[sock];
+		u->starved = p->starved_next;
+		p->starved = false;
+		if (p->recv && !p->recving) {
+			uring_recv_arm(u, sock);
+			break;
+		}
+	}
+}
+
+static void
+uring_buf_init(struct uring *u) {
+	size_t sz = URING_BUF_COUNT * sizeof(struct io_uring_buf);
+	void *ring = mmap(NULL, sz, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (ring == MAP_FAILED)
+		return;
+	struct io_uring_buf_reg reg;
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = (uint64_t)(uintptr_t)ring;
+	reg.ring_entries = URING_BUF_COUNT;
+	reg.bgid = URING_BUF_GROUP;
+	if (syscall(__NR_io_uring_register, u->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+		// before linux 5.19, the stream sockets are polled and read by the socket server
+		fprintf(stderr, "socket-server: io_uring buffer ring is not supported (%s), poll only.\n", strerror(errno));
+		munmap(ring, sz);
+		return;
+	}
+	u->br = ring;
+	u->buf = skynet_malloc((size_t)URING_BUF_COUNT * URING_BUF_SIZE);
+	unsigned i;
+	for (i=0;i<URING_BUF_COUNT;i++) {
+		uring_buf_put(u, i);
+	}
+}
+
+static bool
+sp_invalid(struct uring *u) {
+	return u == NULL;
+}
+
+static void
+sp_release(struct uring *u) {
+	if (u->sqes)
+		munmap(u->sqes, u->sqes_sz);
+	if (u->cq_ring && u->cq_ring != u->sq_ring)
+		munmap(u->cq_ring, u->cq_ring_sz);
+	if (u->sq_ring)
+		munmap(u->sq_ring, u->sq_ring_sz);
+	close(u->fd);
+	if (u->br) {
+		munmap(u->br, URING_BUF_COUNT * sizeof(struct io_uring_buf));
+		skynet_free(u->buf);
+	}
+	skynet_free(u->poll);
+	skynet_free(u);
+}
+
+static struct uring *
+sp_create() {
+	struct io_uring_params p;
+	memset(&p, 0, sizeof(p));
+	p.flags = IORING_SETUP_CQSIZE;
+	p.cq_entries = URING_CQ_ENTRIES;
+	int fd = (int)syscall(__NR_io_uring_setup, URING_ENTRIES, &p);
+	if (fd < 0) {
+		fprintf(stderr, "socket-server: io_uring_setup failed %s.\n", strerror(errno));
+		return NULL;
+	}
+	struct uring *u = skynet_malloc(sizeof(*u));
+	memset(u, 0, sizeof(*u));
+	u->fd = fd;
+	u->starved = -1;
+	u->sq_ring_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	u->cq_ring_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (u->cq_ring_sz > u->sq_ring_sz)
+			u->sq_ring_sz = u->cq_ring_sz;
+		u->cq_ring_sz = u->sq_ring_sz;
+	}
+	void *sq = mmap(NULL, u->sq_ring_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	if (sq == MAP_FAILED)
+		goto _failed;
+	u->sq_ring = sq;
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		u->cq_ring = sq;
+	} else {
+		void *cq = mmap(NULL, u->cq_ring_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+		if (cq == MAP_FAILED)
+			goto _failed;
+		u->cq_ring = cq;
+	}
+	u->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+	void *sqes = mmap(NULL, u->sqes_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+	if (sqes == MAP_FAILED)
+		goto _failed;
+	u->sqes = sqes;
+
+	char *sqp = u->sq_ring;
+	char *cqp = u->cq_ring;
+	u->sq_head = (unsigned *)(sqp + p.sq_off.head);
+	u->sq_tail = (unsigned *)(sqp + p.sq_off.tail);
+	u->sq_mask = *(unsigned *)(sqp + p.sq_off.ring_mask);
+	u->sq_array = (unsigned *)(sqp + p.sq_off.array);
+	u->sq_entries = p.sq_entries;
+	u->sq_local = *u->sq_tail;
+	u->cq_head = (unsigned *)(cqp + p.cq_off.head);
+	u->cq_tail = (unsigned *)(cqp + p.cq_off.tail);
+	u->cq_mask = *(unsigned *)(cqp + p.cq_off.ring_mask);
+	u->cqes = (struct io_uring_cqe *)(cqp + p.cq_off.cqes);
+	uring_buf_init(u);
+	return u;
+_failed:
+	fprintf(stderr, "socket-server: io_uring mmap failed %s.\n", strerror(errno));
+	sp_release(u);
+	return NULL;
+}
+
+static int
+sp_add(struct uring *u, int sock, void *ud) {
+	if (sock >= u->poll_n) {
+		int n = u->poll_n ? u->poll_n : 1024;
+		while (n <= sock)
+			n *= 2;
+		struct uring_poll *poll = skynet_realloc(u->poll, n * sizeof(*poll));
+		if (poll == NULL)
+			return 1;
+		memset(poll + u->poll_n, 0, (n - u->poll_n) * sizeof(*poll));
+		u->poll = poll;
+		u->poll_n = n;
+	}
+	struct uring_poll *p = &u->poll[sock];
+	uring_disarm(u, sock);
+	uring_recv_disarm(u, sock);
+	p->ud = ud;
+	p->events = POLLIN;
+	uring_arm(u, sock);
+	return 0;
+}
+
+static void
+sp_del(struct uring *u, int sock) {
+	if (sock >= u->poll_n)
+		return;
+	uring_disarm(u, sock);
+	uring_recv_disarm(u, sock);
+	u->poll[sock].events = 0;
+}
+
+static void
+sp_write(struct uring *u, int sock, void *ud, bool enable) {
+	if (sock >= u->poll_n || u->poll[sock].events == 0)
+		return;
+	struct uring_poll *p = &u->poll[sock];
+	uint32_t events = POLLIN | (enable ? POLLOUT : 0);
+	p->ud = ud;
+	if (p->events != events) {
+		uring_disarm(u, sock);
+		p->events = events;
+		uring_arm(u, sock);
+	}
+}
+
+// receive the data of the stream socket by recv request, the read events come with the data.
+// After a full buffer (event.more), the socket server reads the rest itself, and calls it again to resume.
+static void
+sp_recv(struct uring *u, int sock, void *ud) {
+	if (u->br == NULL || sock >= u->poll_n)
+		return;
+	struct uring_poll *p = &u->poll[sock];
+	if (p->events == 0)
+		return;
+	p->ud = ud;
+	if (p->recv) {
+		if (!p->recving && !p->starved)
+			uring_recv_arm(u, sock);
+		return;
+	}
+	// stop polling POLLIN
+	uring_disarm(u, sock);
+	p->recv = true;
+	uring_arm(u, sock);
+	uring_recv_arm(u, sock);
+}
+
+// give back the buffer of the read event from sp_recv
+static void
+sp_recv_done(struct uring *u, struct event *e) {
+	if (e->buffer) {
+		e->buffer = NULL;
+		uring_buf_put(u, e->bid);
+	}
+}
+
+static int
+sp_wait(struct uring *u, struct event *e, int max) {
+	int n = 0;
+	for (;;) {
+		unsigned head = *u->cq_head;
+		if (head == __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE)) {
+			// no completion, submit the queued requests and wait
+			int r = uring_enter(u, u->pending, 1, IORING_ENTER_GETEVENTS);
+			if (r < 0) {
+				if (errno == EBUSY || errno == EAGAIN)
+					continue;
+				return -1;
+			}
+			u->pending -= r;
+			continue;
+		}
+		while (n < max && head != __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE)) {
+			struct io_uring_cqe *cqe = &u->cqes[head & u->cq_mask];
+			uint64_t data = cqe->user_data;
+			int res = cqe->res;
+			unsigned flags = cqe->flags;
+			++head;
+			if (data == URING_CANCEL)
+				continue;
+			int sock = (int)(data & 0x7fffffff);
+			uint32_t gen = (uint32_t)(data >> 32);
+			struct uring_poll *p = &u->poll[sock];
+			if ((data >> 31) & 1) {
+				// URING_OP_RECV
+				char *buffer = NULL;
+				unsigned bid = flags >> IORING_CQE_BUFFER_SHIFT;
+				if (flags & IORING_CQE_F_BUFFER) {
+					if (res > 0 && p->rgen == gen && p->recving) {
+						buffer = u->buf + (size_t)bid * URING_BUF_SIZE;
+					} else {
+						uring_buf_put(u, bid);
+					}
+				}
+				if (p->rgen != gen || !p->recving)
+					continue;	// the socket is removed, drop the data
+				p->recving = false;
+				if (res == -ENOBUFS) {
+					// all the buffers are in the events, the socket server gives them back soon
+					uring_starve(u, sock);
+					continue;
+				}
+				if (res == -EINTR || res == -EAGAIN || res == -ECANCELED) {
+					uring_recv_arm(u, sock);
+					continue;
+				}
+				e[n].s = p->ud;
+				e[n].read = true;
+				e[n].write = e[n].error = e[n].eof = false;
+				e[n].received = true;
+				e[n].recv = res;
+				e[n].buffer = buffer;
+				e[n].bid = bid;
+				e[n].more = res == URING_BUF_SIZE;
+				++n;
+				// the socket server closes the socket at eof or error, and resumes it after more data
+				if (res > 0 && res < URING_BUF_SIZE)
+					uring_recv_arm(u, sock);
+				continue;
+			}
+			if (p->gen != gen || !p->armed)
+				continue;	// the interest has changed
+			p->armed = false;
+			if (res == -ECANCELED) {
+				uring_arm(u, sock);
+				continue;
+			}
+			e[n].s = p->ud;
+			if (res < 0) {
+				e[n].read = e[n].write = false;
+				e[n].error = true;
+			} else {
+				e[n].write = (res & POLLOUT) != 0;
+				e[n].read = (res & (POLLIN | POLLHUP)) != 0 && !p->recv;
+				e[n].error = (res & POLLERR) != 0;
+			}
+			e[n].eof = false;
+			e[n].received = false;
+			e[n].buffer = NULL;
+			e[n].more = false;
+			++n;
+			// one-shot poll, arm it again for the next events (level-triggered)
+			uring_arm(u, sock);
+		}
+		__atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+		if (n > 0)
+			return n;
+	}
+}
+
+static void
+sp_nonblocking(int fd) {
+	int flag = fcntl(fd, F_GETFL, 0);
+	if ( -1 == flag ) {
+		return;
+	}
+
+	fcntl(fd, F_SETFL, flag | O_NONBLOCK);
+}
+
+#endif
@@ -3,7 +3,14 @@
 
 #include <stdbool.h>
 
+#if defined(__linux__) && defined(USE_IOURING)
+struct uring;
+typedef struct uring * poll_fd;
+// the backend receives the data of stream sockets itself, see sp_recv()
+#define SP_RECV
+#else
 typedef int poll_fd;
+#endif
 
 struct event {
 	void * s;
@@ -11,6 +18,13 @@ struct event {
 	bool write;
 	bool error;
 	bool eof;
+#ifdef SP_RECV
+	bool received;	// the data of read event is received by the backend
+	int recv;	// > 0 : size of data in buffer, 0 : eof, < 0 : -errno
+	char * buffer;
+	unsigned bid;
+	bool more;	// the buffer is full, the rest is read by the socket server, then sp_recv() again
+#endif
 };
 
 static bool sp_invalid(poll_fd fd);
@@ -21,8 +35,14 @@ static void sp_del(poll_fd fd, int sock);
 static void sp_write(poll_fd, int sock, void *ud, bool enable);
 static int sp_wait(poll_fd, struct event *e, int max);
 static void sp_nonblocking(int sock);
+#ifdef SP_RECV
+static void sp_recv(poll_fd, int sock, void *ud);
+static void sp_recv_done(poll_fd, struct event *e);
+#endif
 
-#ifdef __linux__
+#if defined(__linux__) && defined(USE_IOURING)
+#include "socket_iouring.h"
+#elif defined(__linux__)
 #include "socket_epoll.h"
 #endif
 
@@ -1,3 +1,7 @@
+#if defined(__linux__)
+#define _GNU_SOURCE
+#endif
+
 #include "skynet.h"
 
 #include "socket_server.h"
@@ -7,6 +11,7 @@
 
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/tcp.h>
 #include <unistd.h>
 #include <errno.h>
@@ -16,12 +21,30 @@
 #include <stdint.h>
 #include <assert.h>
 #include <string.h>
+#include <limits.h>
+#include <sched.h>
+
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
 
 #define MAX_INFO 128
 // MAX_SOCKET will be 2^MAX_SOCKET_P
 #define MAX_SOCKET_P 16
 #define MAX_EVENT 64
+#define MAX_SHARD 64
+// MAX_CTRL must be power of 2
+#define MAX_CTRL 4096
+// max buffers gathered by one writev / sendmmsg
+#ifdef IOV_MAX
+#define MAX_IOV IOV_MAX
+#else
+#define MAX_IOV 1024
+#endif
+#define MAX_UDP_BATCH 64
 #define MIN_READ_BUFFER 64
+// the reads not larger than it go to the read buffer of shard first
+#define SMALL_READ_BUFFER 4096
 #define SOCKET_TYPE_INVALID 0
 #define SOCKET_TYPE_RESERVE 1
 #define SOCKET_TYPE_PLISTEN 2
@@ -38,6 +61,8 @@
 #define PRIORITY_LOW 1
 
 #define HASH_ID(id) (((unsigned)id) % MAX_SOCKET)
+// the shard (poll thread) owns the socket id
+#define SHARD(ss, id) ((ss)->group->shard[HASH_ID(id) % (ss)->group->shards])
 #define ID_TAG16(id) ((id>>MAX_SOCKET_P) & 0xffff)
 
 #define PROTOCOL_TCP 0
@@ -105,21 +130,72 @@ struct socket {
 	size_t dw_size;
 };
 
+struct socket_server;
+
+union sockaddr_all {
+	struct sockaddr s;
+	struct sockaddr_in v4;
+	struct sockaddr_in6 v6;
+};
+
+#ifdef __linux__
+typedef struct mmsghdr udp_msghdr;
+#else
+typedef struct {
+	struct msghdr msg_hdr;
+	unsigned int msg_len;
+} udp_msghdr;
+#endif
+
+// One ctrl command. The slot is free for the producer when seq == position,
+// and ready for the poll thread when seq == position + 1 (see ctrl_queue).
+struct ctrl_slot {
+	unsigned seq;
+	uint8_t type;
+	union {
+		char buffer[256];
+		uintptr_t align;
+	} u;
+};
+
+// Bounded MPSC ring of ctrl commands, filled by any thread and drained by the poll thread of the shard.
+struct ctrl_queue {
+	unsigned head;	// next position to claim by producers
+	char pad[64 - sizeof(unsigned)];
+	unsigned tail;	// next position to read by the poll thread
+	struct ctrl_slot slot[MAX_CTRL];
+};
+
+// The sockets are sharded by id. Each shard (struct socket_server) has its own poll thread,
+// event poll and ctrl queue, and the commands of a socket are sent to the shard owns it,
+// so the messages of one socket are still in order.
+struct socket_group {
+	int alloc_id;
+	int shards;
+	struct socket_object_interface soi;
+	struct socket_server *shard[MAX_SHARD];
+	struct socket slot[MAX_SOCKET];
+};
+
 struct socket_server {
 	volatile uint64_t time;
-	int recvctrl_fd;
-	int sendctrl_fd;
+	int recvctrl_fd;	// eventfd (or pipe) to wake up the poll thread
+	int sendctrl_fd;	// the same fd as recvctrl_fd for eventfd
 	int checkctrl;
+	int sleeping;	// the poll thread is (going to be) blocked in sp_wait
 	poll_fd event_fd;
-	int alloc_id;
 	int event_n;
 	int event_index;
-	struct socket_object_interface soi;
+	struct socket_group *group;
+	struct socket *slot;	// group->slot, shared by all the shards
 	struct event ev[MAX_EVENT];
-	struct socket slot[MAX_SOCKET];
 	char buffer[MAX_INFO];
 	uint8_t udpbuffer[MAX_UDP_PACKAGE];
-	fd_set rfds;
+	char readbuffer[SMALL_READ_BUFFER];
+	struct iovec iov[MAX_IOV];
+	udp_msghdr udpmsg[MAX_UDP_BATCH];
+	union sockaddr_all udpaddr[MAX_UDP_BATCH];
+	struct ctrl_queue ctrl;
 };
 
 struct request_open {
@@ -193,6 +269,7 @@ struct request_udp {
 	X Exit
 	D Send package (high)
 	P Send package (low)
+	W Enable write event (after direct write)
 	A Send UDP package
 	T Set opt
 	U Create UDP socket
@@ -201,7 +278,6 @@ struct request_udp {
  */
 
 struct request_package {
-	uint8_t header[8];	// 6 bytes dummy
 	union {
 		char buffer[256];
 		struct request_open open;
@@ -218,12 +294,6 @@ struct request_package {
 	uint8_t dummy[256];
 };
 
-union sockaddr_all {
-	struct sockaddr s;
-	struct sockaddr_in v4;
-	struct sockaddr_in6 v6;
-};
-
 struct send_object {
 	void * buffer;
 	int sz;
@@ -274,9 +344,9 @@ socket_unlock(struct socket_lock *sl) {
 static inline bool
 send_object_init(struct socket_server *ss, struct send_object *so, void *object, int sz) {
 	if (sz < 0) {
-		so->buffer = ss->soi.buffer(object);
-		so->sz = ss->soi.size(object);
-		so->free_func = ss->soi.free;
+		so->buffer = ss->group->soi.buffer(object);
+		so->sz = ss->group->soi.size(object);
+		so->free_func = ss->group->soi.free;
 		return true;
 	} else {
 		so->buffer = object;
@@ -289,7 +359,7 @@ send_object_init(struct socket_server *ss, struct send_object *so, void *object,
 static inline void
 write_buffer_free(struct socket_server *ss, struct write_buffer *wb) {
 	if (wb->userobject) {
-		ss->soi.free(wb->buffer);
+		ss->group->soi.free(wb->buffer);
 	} else {
 		FREE(wb->buffer);
 	}
@@ -306,9 +376,9 @@ static int
 reserve_id(struct socket_server *ss) {
 	int i;
 	for (i=0;i<MAX_SOCKET;i++) {
-		int id = ATOM_INC(&(ss->alloc_id));
+		int id = ATOM_INC(&(ss->group->alloc_id));
 		if (id < 0) {
-			id = ATOM_AND(&(ss->alloc_id), 0x7fffffff);
+			id = ATOM_AND(&(ss->group->alloc_id), 0x7fffffff);
 		}
 		struct socket *s = &ss->slot[HASH_ID(id)];
 		if (s->type == SOCKET_TYPE_INVALID) {
@@ -335,25 +405,47 @@ clear_wb_list(struct wb_list *list) {
 	list->tail = NULL;
 }
 
-struct socket_server * 
-socket_server_create(uint64_t time) {
-	int i;
+static int
+wakeup_create(int fd[2]) {
+#ifdef __linux__
+	int efd = eventfd(0, EFD_NONBLOCK);
+	if (efd < 0)
+		return -1;
+	fd[0] = fd[1] = efd;
+#else
+	if (pipe(fd))
+		return -1;
+	sp_nonblocking(fd[0]);
+	sp_nonblocking(fd[1]);
+#endif
+	return 0;
+}
+
+static void
+wakeup_release(int fd[2]) {
+	close(fd[0]);
+	if (fd[1] != fd[0])
+		close(fd[1]);
+}
+
+static struct socket_server *
+shard_create(struct socket_group *g, uint64_t time) {
 	int fd[2];
+	unsigned i;
 	poll_fd efd = sp_create();
 	if (sp_invalid(efd)) {
 		fprintf(stderr, "socket-server: create event pool failed.\n");
 		return NULL;
 	}
-	if (pipe(fd)) {
+	if (wakeup_create(fd)) {
 		sp_release(efd);
-		fprintf(stderr, "socket-server: create socket pair failed.\n");
+		fprintf(stderr, "socket-server: create wakeup fd failed.\n");
 		return NULL;
 	}
 	if (sp_add(efd, fd[0], NULL)) {
 		// add recvctrl_fd to event poll
 		fprintf(stderr, "socket-server: can't add server fd to event pool.\n");
-		close(fd[0]);
-		close(fd[1]);
+		wakeup_release(fd);
 		sp_release(efd);
 		return NULL;
 	}
@@ -364,27 +456,79 @@ socket_server_create(uint64_t time) {
 	ss->recvctrl_fd = fd[0];
 	ss->sendctrl_fd = fd[1];
 	ss->checkctrl = 1;
+	ss->sleeping = 0;
+	ss->event_n = 0;
+	ss->event_index = 0;
+	ss->group = g;
+	ss->slot = g->slot;
+	ss->ctrl.head = 0;
+	ss->ctrl.tail = 0;
+	for (i=0;i<MAX_CTRL;i++) {
+		ss->ctrl.slot[i].seq = i;
+	}
+
+	return ss;
+}
+
+static void
+shard_release(struct socket_server *ss) {
+	int fd[2] = { ss->recvctrl_fd, ss->sendctrl_fd };
+	wakeup_release(fd);
+	sp_release(ss->event_fd);
+	FREE(ss);
+}
 
+// return the first shard, use socket_server_shard() to get the others for their poll threads
+struct socket_server * 
+socket_server_create(uint64_t time, int shards) {
+	int i;
+	if (shards < 1) {
+		shards = 1;
+	} else if (shards > MAX_SHARD) {
+		shards = MAX_SHARD;
+	}
+	struct socket_group *g = MALLOC(sizeof(*g));
 	for (i=0;i<MAX_SOCKET;i++) {
-		struct socket *s = &ss->slot[i];
+		struct socket *s = &g->slot[i];
 		s->type = SOCKET_TYPE_INVALID;
 		clear_wb_list(&s->high);
 		clear_wb_list(&s->low);
 		spinlock_init(&s->dw_lock);
 	}
-	ss->alloc_id = 0;
-	ss->event_n = 0;
-	ss->event_index = 0;
-	memset(&ss->soi, 0, sizeof(ss->soi));
-	FD_ZERO(&ss->rfds);
-	assert(ss->recvctrl_fd < FD_SETSIZE);
+	g->alloc_id = 0;
+	memset(&g->soi, 0, sizeof(g->soi));
+	memset(g->shard, 0, sizeof(g->shard));
+	g->shards = shards;
+	for (i=0;i<shards;i++) {
+		g->shard[i] = shard_create(g, time);
+		if (g->shard[i] == NULL) {
+			while (--i >= 0) {
+				shard_release(g->shard[i]);
+			}
+			FREE(g);
+			return NULL;
+		}
+	}
 
-	return ss;
+	return g->shard[0];
+}
+
+int
+socket_server_shards(struct socket_server *ss) {
+	return ss->group->shards;
+}
+
+struct socket_server *
+socket_server_shard(struct socket_server *ss, int index) {
+	return ss->group->shard[index];
 }
 
 void
 socket_server_updatetime(struct socket_server *ss, uint64_t time) {
-	ss->time = time;
+	int i;
+	for (i=0;i<ss->group->shards;i++) {
+		ss->group->shard[i]->time = time;
+	}
 }
 
 static void
@@ -439,19 +583,20 @@ void
 socket_server_release(struct socket_server *ss) {
 	int i;
 	struct socket_message dummy;
+	struct socket_group *g = ss->group;
 	for (i=0;i<MAX_SOCKET;i++) {
-		struct socket *s = &ss->slot[i];
+		struct socket *s = &g->slot[i];
 		struct socket_lock l;
 		socket_lock_init(s, &l);
 		if (s->type != SOCKET_TYPE_RESERVE) {
-			force_close(ss, s, &l, &dummy);
+			force_close(SHARD(ss, s->id), s, &l, &dummy);
 		}
 		spinlock_destroy(&s->dw_lock);
 	}
-	close(ss->sendctrl_fd);
-	close(ss->recvctrl_fd);
-	sp_release(ss->event_fd);
-	FREE(ss);
+	for (i=0;i<g->shards;i++) {
+		shard_release(g->shard[i]);
+	}
+	FREE(g);
 }
 
 static inline void
@@ -460,6 +605,22 @@ check_wb_list(struct wb_list *s) {
 	assert(s->tail == NULL);
 }
 
+// the backend receives the data of a connected tcp socket itself if it can (io_uring), see sp_recv()
+static inline void
+recv_stream(struct socket_server *ss, struct socket *s) {
+#ifdef SP_RECV
+	sp_recv(ss->event_fd, s->fd, s);
+#endif
+}
+
+// give back the data buffer of an event which won't be forwarded
+static inline void
+release_event(struct socket_server *ss, struct event *e) {
+#ifdef SP_RECV
+	sp_recv_done(ss->event_fd, e);
+#endif
+}
+
 static struct socket *
 new_fd(struct socket_server *ss, int id, int fd, int protocol, uintptr_t opaque, bool add) {
 	struct socket * s = &ss->slot[HASH_ID(id)];
@@ -556,6 +717,7 @@ open_socket(struct socket_server *ss, struct request_open * request, struct sock
 
 	if(status == 0) {
 		ns->type = SOCKET_TYPE_CONNECTED;
+		recv_stream(ss, ns);
 		struct sockaddr * addr = ai_ptr->ai_addr;
 		void * sin_addr = (ai_ptr->ai_family == AF_INET) ? (void*)&((struct sockaddr_in *)addr)->sin_addr : (void*)&((struct sockaddr_in6 *)addr)->sin6_addr;
 		if (inet_ntop(ai_ptr->ai_family, sin_addr, ss->buffer, sizeof(ss->buffer))) {
@@ -576,37 +738,68 @@ _failed:
 	return SOCKET_ERR;
 }
 
+// The write buffers of a socket are the high list followed by the low list.
+static inline struct write_buffer *
+first_buffer(struct socket *s) {
+	return s->high.head ? s->high.head : s->low.head;
+}
+
+static inline struct write_buffer *
+next_buffer(struct socket *s, struct write_buffer *wb) {
+	if (wb->next)
+		return wb->next;
+	return wb == s->high.tail ? s->low.head : NULL;
+}
+
+// remove the head of the two lists after it has been sent
+static void
+pop_buffer(struct socket_server *ss, struct socket *s) {
+	struct wb_list *list = s->high.head ? &s->high : &s->low;
+	struct write_buffer *tmp = list->head;
+	list->head = tmp->next;
+	if (list->head == NULL)
+		list->tail = NULL;
+	write_buffer_free(ss,tmp);
+}
+
 static int
-send_list_tcp(struct socket_server *ss, struct socket *s, struct wb_list *list, struct socket_lock *l, struct socket_message *result) {
-	while (list->head) {
-		struct write_buffer * tmp = list->head;
-		for (;;) {
-			ssize_t sz = write(s->fd, tmp->ptr, tmp->sz);
-			if (sz < 0) {
-				switch(errno) {
-				case EINTR:
-					continue;
-				case AGAIN_WOULDBLOCK:
-					return -1;
-				}
-				force_close(ss,s,l,result);
-				return SOCKET_CLOSE;
+send_list_tcp(struct socket_server *ss, struct socket *s, struct socket_lock *l, struct socket_message *result) {
+	for (;;) {
+		struct iovec *iov = ss->iov;
+		struct write_buffer *wb;
+		int i, n = 0;
+		for (wb = first_buffer(s); wb && n < MAX_IOV; wb = next_buffer(s, wb)) {
+			iov[n].iov_base = wb->ptr;
+			iov[n].iov_len = wb->sz;
+			++n;
+		}
+		if (n == 0)
+			return -1;
+		ssize_t sz = writev(s->fd, iov, n);
+		if (sz < 0) {
+			switch(errno) {
+			case EINTR:
+				continue;
+			case AGAIN_WOULDBLOCK:
+				return -1;
 			}
-			stat_write(ss,s,(int)sz);
-			s->wb_size -= sz;
-			if (sz != tmp->sz) {
-				tmp->ptr += sz;
-				tmp->sz -= sz;
+			force_close(ss,s,l,result);
+			return SOCKET_CLOSE;
+		}
+		stat_write(ss,s,(int)sz);
+		s->wb_size -= sz;
+		for (i=0;i<n;i++) {
+			wb = first_buffer(s);
+			if (sz < wb->sz) {
+				// partial write, the kernel buffer is full
+				wb->ptr += sz;
+				wb->sz -= sz;
 				return -1;
 			}
-			break;
+			sz -= wb->sz;
+			pop_buffer(ss, s);
 		}
-		list->head = tmp->next;
-		write_buffer_free(ss,tmp);
 	}
-	list->tail = NULL;
-
-	return -1;
 }
 
 static socklen_t
@@ -633,53 +826,93 @@ udp_socket_address(struct socket *s, const uint8_t udp_address[UDP_ADDRESS_SIZE]
 	return 0;
 }
 
+#ifdef __linux__
+
+static inline int
+udp_sendmmsg(int fd, udp_msghdr *msg, int n) {
+	return sendmmsg(fd, msg, n, 0);
+}
+
+#else
+
+// no sendmmsg, send them one by one
+static int
+udp_sendmmsg(int fd, udp_msghdr *msg, int n) {
+	int i;
+	for (i=0;i<n;i++) {
+		ssize_t sz = sendmsg(fd, &msg[i].msg_hdr, 0);
+		if (sz < 0)
+			return i == 0 ? -1 : i;
+		msg[i].msg_len = (unsigned int)sz;
+	}
+	return n;
+}
+
+#endif
+
 static void
-drop_udp(struct socket_server *ss, struct socket *s, struct wb_list *list, struct write_buffer *tmp) {
-	s->wb_size -= tmp->sz;
-	list->head = tmp->next;
-	if (list->head == NULL)
-		list->tail = NULL;
-	write_buffer_free(ss,tmp);
+drop_udp(struct socket_server *ss, struct socket *s) {
+	s->wb_size -= first_buffer(s)->sz;
+	pop_buffer(ss, s);
 }
 
 static int
-send_list_udp(struct socket_server *ss, struct socket *s, struct wb_list *list, struct socket_message *result) {
-	while (list->head) {
-		struct write_buffer * tmp = list->head;
-		union sockaddr_all sa;
-		socklen_t sasz = udp_socket_address(s, tmp->udp_address, &sa);
-		if (sasz == 0) {
-			fprintf(stderr, "socket-server : udp (%d) type mismatch.\n", s->id);
-			drop_udp(ss, s, list, tmp);
+send_list_udp(struct socket_server *ss, struct socket *s, struct socket_message *result) {
+	for (;;) {
+		struct write_buffer *wb;
+		int i, n = 0;
+		for (wb = first_buffer(s); wb && n < MAX_UDP_BATCH; wb = next_buffer(s, wb)) {
+			union sockaddr_all *sa = &ss->udpaddr[n];
+			socklen_t sasz = udp_socket_address(s, wb->udp_address, sa);
+			if (sasz == 0)
+				break;
+			struct iovec *iov = &ss->iov[n];
+			iov->iov_base = wb->ptr;
+			iov->iov_len = wb->sz;
+			struct msghdr *msg = &ss->udpmsg[n].msg_hdr;
+			memset(msg, 0, sizeof(*msg));
+			msg->msg_name = &sa->s;
+			msg->msg_namelen = sasz;
+			msg->msg_iov = iov;
+			msg->msg_iovlen = 1;
+			++n;
+		}
+		if (n == 0) {
+			if (first_buffer(s)) {
+				fprintf(stderr, "socket-server : udp (%d) type mismatch.\n", s->id);
+				drop_udp(ss, s);
+			}
 			return -1;
 		}
-		int err = sendto(s->fd, tmp->ptr, tmp->sz, 0, &sa.s, sasz);
-		if (err < 0) {
+		int sent = udp_sendmmsg(s->fd, ss->udpmsg, n);
+		if (sent < 0) {
 			switch(errno) {
 			case EINTR:
 			case AGAIN_WOULDBLOCK:
 				return -1;
 			}
 			fprintf(stderr, "socket-server : udp (%d) sendto error %s.\n",s->id, strerror(errno));
-			drop_udp(ss, s, list, tmp);
+			drop_udp(ss, s);
 			return -1;
 		}
-		stat_write(ss,s,tmp->sz);
-		s->wb_size -= tmp->sz;
-		list->head = tmp->next;
-		write_buffer_free(ss,tmp);
+		for (i=0;i<sent;i++) {
+			wb = first_buffer(s);
+			stat_write(ss,s,wb->sz);
+			s->wb_size -= wb->sz;
+			pop_buffer(ss, s);
+		}
+		if (sent < n)
+			return -1;
 	}
-	list->tail = NULL;
-
-	return -1;
 }
 
+// send the high list and then the low list, until both are empty or the socket blocks
 static int
-send_list(struct socket_server *ss, struct socket *s, struct wb_list *list, struct socket_lock *l, struct socket_message *result) {
+send_list(struct socket_server *ss, struct socket *s, struct socket_lock *l, struct socket_message *result) {
 	if (s->protocol == PROTOCOL_TCP) {
-		return send_list_tcp(ss, s, list, l, result);
+		return send_list_tcp(ss, s, l, result);
 	} else {
-		return send_list_udp(ss, s, list, result);
+		return send_list_udp(ss, s, result);
 	}
 }
 
@@ -719,22 +952,19 @@ send_buffer_empty(struct socket *s) {
 
 	1. send high list as far as possible.
 	2. If high list is empty, try to send low list.
+	   (Step 1 and 2 are one writev/sendmmsg, the low list is gathered after the high list.)
 	3. If low list head is uncomplete (send a part before), move the head of low list to empty high list (call raise_uncomplete) .
 	4. If two lists are both empty, turn off the event. (call check_close)
  */
 static int
 send_buffer_(struct socket_server *ss, struct socket *s, struct socket_lock *l, struct socket_message *result) {
 	assert(!list_uncomplete(&s->low));
-	// step 1
-	if (send_list(ss,s,&s->high,l,result) == SOCKET_CLOSE) {
+	// step 1 and 2
+	if (send_list(ss,s,l,result) == SOCKET_CLOSE) {
 		return SOCKET_CLOSE;
 	}
 	if (s->high.head == NULL) {
-		// step 2
 		if (s->low.head != NULL) {
-			if (send_list(ss,s,&s->low,l,result) == SOCKET_CLOSE) {
-				return SOCKET_CLOSE;
-			}
 			// step 3
 			if (list_uncomplete(&s->low)) {
 				raise_uncomplete(s);
@@ -1001,7 +1231,12 @@ start_socket(struct socket_server *ss, struct request_start *request, struct soc
 			result->data = strerror(errno);
 			return SOCKET_ERR;
 		}
-		s->type = (s->type == SOCKET_TYPE_PACCEPT) ? SOCKET_TYPE_CONNECTED : SOCKET_TYPE_LISTEN;
+		if (s->type == SOCKET_TYPE_PACCEPT) {
+			s->type = SOCKET_TYPE_CONNECTED;
+			recv_stream(ss, s);
+		} else {
+			s->type = SOCKET_TYPE_LISTEN;
+		}
 		s->opaque = request->opaque;
 		result->data = "start";
 		return SOCKET_OPEN;
@@ -1027,33 +1262,24 @@ setopt_socket(struct socket_server *ss, struct request_setopt *request) {
 }
 
 static void
-block_readpipe(int pipefd, void *buffer, int sz) {
+clear_wakeup(struct socket_server *ss) {
+	// eventfd resets by one read, a pipe may have more bytes (it's nonblocking).
+	char tmp[64];
 	for (;;) {
-		int n = read(pipefd, buffer, sz);
-		if (n<0) {
-			if (errno == EINTR)
-				continue;
-			fprintf(stderr, "socket-server : read pipe error %s.\n",strerror(errno));
+		int n = read(ss->recvctrl_fd, tmp, sizeof(tmp));
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < (int)sizeof(tmp))
 			return;
-		}
-		// must atomic read from a pipe
-		assert(n == sz);
-		return;
 	}
 }
 
-static int
+// no syscall, only check the slot at the tail of ctrl queue
+static inline int
 has_cmd(struct socket_server *ss) {
-	struct timeval tv = {0,0};
-	int retval;
-
-	FD_SET(ss->recvctrl_fd, &ss->rfds);
-
-	retval = select(ss->recvctrl_fd+1, &ss->rfds, NULL, NULL, &tv);
-	if (retval == 1) {
-		return 1;
-	}
-	return 0;
+	struct ctrl_queue *q = &ss->ctrl;
+	unsigned pos = q->tail;
+	return ATOM_LOAD(&q->slot[pos & (MAX_CTRL-1)].seq) == pos + 1;
 }
 
 static void
@@ -1133,18 +1359,17 @@ dec_sending_ref(struct socket_server *ss, int id) {
 	}
 }
 
-// return type
+static void
+trigger_write(struct socket_server *ss, struct request_send *request) {
+	int id = request->id;
+	struct socket *s = &ss->slot[HASH_ID(id)];
+	if (s->type == SOCKET_TYPE_INVALID || s->id != id)
+		return;
+	sp_write(ss->event_fd, s->fd, s, true);
+}
+
 static int
-ctrl_cmd(struct socket_server *ss, struct socket_message *result) {
-	int fd = ss->recvctrl_fd;
-	// the length of message is one byte, so 256+8 buffer size is enough.
-	uint8_t buffer[256];
-	uint8_t header[2];
-	block_readpipe(fd, header, sizeof(header));
-	int type = header[0];
-	int len = header[1];
-	block_readpipe(fd, buffer, len);
-	// ctrl command only exist in local fd, so don't worry about endian.
+ctrl_dispatch(struct socket_server *ss, int type, char *buffer, struct socket_message *result) {
 	switch (type) {
 	case 'S':
 		return start_socket(ss,(struct request_start *)buffer, result);
@@ -1170,6 +1395,9 @@ ctrl_cmd(struct socket_server *ss, struct socket_message *result) {
 		dec_sending_ref(ss, request->id);
 		return ret;
 	}
+	case 'W':
+		trigger_write(ss, (struct request_send *)buffer);
+		return -1;
 	case 'A': {
 		struct request_send_udp * rsu = (struct request_send_udp *)buffer;
 		return send_socket(ss, &rsu->send, result, PRIORITY_HIGH, rsu->address);
@@ -1190,14 +1418,32 @@ ctrl_cmd(struct socket_server *ss, struct socket_message *result) {
 	return -1;
 }
 
+// return type, call it only when has_cmd(ss)
+static int
+ctrl_cmd(struct socket_server *ss, struct socket_message *result) {
+	struct ctrl_queue *q = &ss->ctrl;
+	unsigned pos = q->tail;
+	struct ctrl_slot *slot = &q->slot[pos & (MAX_CTRL-1)];
+	// the command is handled in place, the result never points to the request buffer.
+	int type = ctrl_dispatch(ss, slot->type, slot->u.buffer, result);
+	q->tail = pos + 1;
+	// give the slot back to producers for the next round
+	ATOM_STORE(&slot->seq, pos + MAX_CTRL);
+	return type;
+}
+
 // return -1 (ignore) when error
 static int
 forward_message_tcp(struct socket_server *ss, struct socket *s, struct socket_lock *l, struct socket_message * result) {
 	int sz = s->p.size;
-	char * buffer = MALLOC(sz);
+	// A small read is copied to a buffer of exact size from the message pool, because the
+	// receiver frees it on a worker thread. A large one is read into its own buffer directly.
+	int small = sz <= SMALL_READ_BUFFER;
+	char * buffer = small ? ss->readbuffer : MALLOC(sz);
 	int n = (int)read(s->fd, buffer, sz);
 	if (n<0) {
-		FREE(buffer);
+		if (!small)
+			FREE(buffer);
 		switch(errno) {
 		case EINTR:
 			break;
@@ -1213,14 +1459,16 @@ forward_message_tcp(struct socket_server *ss, struct socket *s, struct socket_lo
 		return -1;
 	}
 	if (n==0) {
-		FREE(buffer);
+		if (!small)
+			FREE(buffer);
 		force_close(ss, s, l, result);
 		return SOCKET_CLOSE;
 	}
 
 	if (s->type == SOCKET_TYPE_HALFCLOSE) {
 		// discard recv data
-		FREE(buffer);
+		if (!small)
+			FREE(buffer);
 		return -1;
 	}
 
@@ -1232,6 +1480,76 @@ forward_message_tcp(struct socket_server *ss, struct socket *s, struct socket_lo
 		s->p.size /= 2;
 	}
 
+	if (small) {
+		buffer = skynet_message_alloc(n);
+		memcpy(buffer, ss->readbuffer, n);
+	}
+
+	result->opaque = s->opaque;
+	result->id = s->id;
+	result->ud = n;
+	result->data = buffer;
+	return SOCKET_DATA;
+}
+
+#ifdef SP_RECV
+
+static inline bool
+event_received(struct event *e) {
+	return e->received;
+}
+
+// the data is received by the backend already, see sp_recv()
+static int
+forward_message_received(struct socket_server *ss, struct socket *s, struct socket_lock *l, struct socket_message * result, struct event *e) {
+	int n = e->recv;
+	if (n < 0) {
+		// the backend retries EINTR and EAGAIN itself
+		force_close(ss, s, l, result);
+		result->data = strerror(-n);
+		return SOCKET_ERR;
+	}
+	if (n == 0) {
+		force_close(ss, s, l, result);
+		return SOCKET_CLOSE;
+	}
+
+	if (s->type == SOCKET_TYPE_HALFCLOSE) {
+		// discard recv data
+		sp_recv_done(ss->event_fd, e);
+		if (e->more)
+			sp_recv(ss->event_fd, s->fd, s);
+		return -1;
+	}
+
+	// copy it out, the buffer of backend goes back for the next recv
+	char * buffer;
+	if (e->more) {
+		// The buffer of backend is full, read the rest directly (in the size of forward_message_tcp),
+		// and the backend receives again after it.
+		int sz = s->p.size;
+		buffer = MALLOC(n + sz);
+		memcpy(buffer, e->buffer, n);
+		sp_recv_done(ss->event_fd, e);
+		int r = (int)read(s->fd, buffer + n, sz);
+		// the error or eof is reported by the next recv
+		if (r > 0) {
+			n += r;
+		}
+		if (r == sz) {
+			s->p.size *= 2;
+		} else if (sz > MIN_READ_BUFFER && r*2 < sz) {
+			s->p.size /= 2;
+		}
+		sp_recv(ss->event_fd, s->fd, s);
+	} else {
+		buffer = skynet_message_alloc(n);
+		memcpy(buffer, e->buffer, n);
+		sp_recv_done(ss->event_fd, e);
+	}
+
+	stat_read(ss,s,n);
+
 	result->opaque = s->opaque;
 	result->id = s->id;
 	result->ud = n;
@@ -1239,6 +1557,20 @@ forward_message_tcp(struct socket_server *ss, struct socket *s, struct socket_lo
 	return SOCKET_DATA;
 }
 
+#else
+
+static inline bool
+event_received(struct event *e) {
+	return false;
+}
+
+static inline int
+forward_message_received(struct socket_server *ss, struct socket *s, struct socket_lock *l, struct socket_message * result, struct event *e) {
+	return -1;
+}
+
+#endif
+
 static int
 gen_udp_address(int protocol, union sockaddr_all *sa, uint8_t * udp_address) {
 	int addrsz = 1;
@@ -1281,12 +1613,12 @@ forward_message_udp(struct socket_server *ss, struct socket *s, struct socket_lo
 	if (slen == sizeof(sa.v4)) {
 		if (s->protocol != PROTOCOL_UDP)
 			return -1;
-		data = MALLOC(n + 1 + 2 + 4);
+		data = skynet_message_alloc(n + 1 + 2 + 4);
 		gen_udp_address(PROTOCOL_UDP, &sa, data + n);
 	} else {
 		if (s->protocol != PROTOCOL_UDPv6)
 			return -1;
-		data = MALLOC(n + 1 + 2 + 16);
+		data = skynet_message_alloc(n + 1 + 2 + 16);
 		gen_udp_address(PROTOCOL_UDPv6, &sa, data + n);
 	}
 	memcpy(data, ss->udpbuffer, n);
@@ -1319,6 +1651,7 @@ report_connect(struct socket_server *ss, struct socket *s, struct socket_lock *l
 		if (nomore_sending_data(s)) {
 			sp_write(ss->event_fd, s->fd, s, false);
 		}
+		recv_stream(ss, s);
 		union sockaddr_all u;
 		socklen_t slen = sizeof(u);
 		if (getpeername(s->fd, &u.s, &slen) == 0) {
@@ -1401,9 +1734,10 @@ clear_closed_event(struct socket_server *ss, struct socket_message * result, int
 			struct event *e = &ss->ev[i];
 			struct socket *s = e->s;
 			if (s) {
+				// a backend may report the read and write of a socket in different events (io_uring)
 				if (s->type == SOCKET_TYPE_INVALID && s->id == id) {
+					release_event(ss, e);
 					e->s = NULL;
-					break;
 				}
 			}
 		}
@@ -1427,7 +1761,17 @@ socket_server_poll(struct socket_server *ss, struct socket_message * result, int
 			}
 		}
 		if (ss->event_index == ss->event_n) {
+			// Announce sleeping before the last check of ctrl queue, send_request reads it after
+			// publishing its command, so one of them must see the other.
+			ATOM_STORE(&ss->sleeping, 1);
+			__sync_synchronize();
+			if (has_cmd(ss)) {
+				ATOM_STORE(&ss->sleeping, 0);
+				ss->checkctrl = 1;
+				continue;
+			}
 			ss->event_n = sp_wait(ss->event_fd, ss->ev, MAX_EVENT);
+			ATOM_STORE(&ss->sleeping, 0);
 			ss->checkctrl = 1;
 			if (more) {
 				*more = 0;
@@ -1444,7 +1788,8 @@ socket_server_poll(struct socket_server *ss, struct socket_message * result, int
 		struct event *e = &ss->ev[ss->event_index++];
 		struct socket *s = e->s;
 		if (s == NULL) {
-			// dispatch pipe message at beginning
+			// wakeup fd, the ctrl commands are dispatched at beginning
+			clear_wakeup(ss);
 			continue;
 		}
 		struct socket_lock l;
@@ -1464,11 +1809,14 @@ socket_server_poll(struct socket_server *ss, struct socket_message * result, int
 		}
 		case SOCKET_TYPE_INVALID:
 			fprintf(stderr, "socket-server: invalid socket\n");
+			release_event(ss, e);
 			break;
 		default:
 			if (e->read) {
 				int type;
-				if (s->protocol == PROTOCOL_TCP) {
+				if (event_received(e)) {
+					type = forward_message_received(ss, s, &l, result, e);
+				} else if (s->protocol == PROTOCOL_TCP) {
 					type = forward_message_tcp(ss, s, &l, result);
 				} else {
 					type = forward_message_udp(ss, s, &l, result);
@@ -1485,12 +1833,14 @@ socket_server_poll(struct socket_server *ss, struct socket_message * result, int
 				}
 				if (type == -1)
 					break;				
+				clear_closed_event(ss, result, type);
 				return type;
 			}
 			if (e->write) {
 				int type = send_buffer(ss, s, &l, result);
 				if (type == -1)
 					break;
+				clear_closed_event(ss, result, type);
 				return type;
 			}
 			if (e->error) {
@@ -1508,10 +1858,12 @@ socket_server_poll(struct socket_server *ss, struct socket_message * result, int
 				}
 				force_close(ss, s, &l, result);
 				result->data = (char *)err;
+				clear_closed_event(ss, result, SOCKET_ERR);
 				return SOCKET_ERR;
 			}
 			if(e->eof) {
 				force_close(ss, s, &l, result);
+				clear_closed_event(ss, result, SOCKET_CLOSE);
 				return SOCKET_CLOSE;
 			}
 			break;
@@ -1520,22 +1872,50 @@ socket_server_poll(struct socket_server *ss, struct socket_message * result, int
 }
 
 static void
-send_request(struct socket_server *ss, struct request_package *request, char type, int len) {
-	request->header[6] = (uint8_t)type;
-	request->header[7] = (uint8_t)len;
+wakeup(struct socket_server *ss) {
+	uint64_t one = 1;
 	for (;;) {
-		ssize_t n = write(ss->sendctrl_fd, &request->header[6], len+2);
-		if (n<0) {
-			if (errno != EINTR) {
-				fprintf(stderr, "socket-server : send ctrl command error %s.\n", strerror(errno));
+		ssize_t n = write(ss->sendctrl_fd, &one, sizeof(one));
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			// EAGAIN : the pipe is full, so it's readable already
+			if (errno != EAGAIN && errno != EWOULDBLOCK) {
+				fprintf(stderr, "socket-server : wakeup poll thread error %s.\n", strerror(errno));
 			}
-			continue;
 		}
-		assert(n == len+2);
 		return;
 	}
 }
 
+static void
+send_request(struct socket_server *ss, struct request_package *request, char type, int len) {
+	struct ctrl_queue *q = &ss->ctrl;
+	struct ctrl_slot *slot;
+	unsigned pos;
+	for (;;) {
+		pos = ATOM_LOAD(&q->head);
+		slot = &q->slot[pos & (MAX_CTRL-1)];
+		int diff = (int)(ATOM_LOAD(&slot->seq) - pos);
+		if (diff == 0) {
+			if (ATOM_CAS(&q->head, pos, pos + 1))
+				break;
+		} else if (diff < 0) {
+			// the queue is full, wait for the poll thread (it's awake, the commands in queue have woken it).
+			sched_yield();
+		}
+		// else another producer claimed pos, retry
+	}
+	slot->type = (uint8_t)type;
+	memcpy(slot->u.buffer, request->u.buffer, len);
+	ATOM_STORE(&slot->seq, pos + 1);
+	__sync_synchronize();
+	// only the first producer after the poll thread goes to sleep pays for the syscall
+	if (ATOM_LOAD(&ss->sleeping) && ATOM_CAS(&ss->sleeping, 1, 0)) {
+		wakeup(ss);
+	}
+}
+
 static int
 open_request(struct socket_server *ss, struct request_package *req, uintptr_t opaque, const char *addr, int port) {
 	int len = strlen(addr);
@@ -1561,7 +1941,7 @@ socket_server_connect(struct socket_server *ss, uintptr_t opaque, const char * a
 	int len = open_request(ss, &request, opaque, addr, port);
 	if (len < 0)
 		return -1;
-	send_request(ss, &request, 'O', sizeof(request.u.open) + len);
+	send_request(SHARD(ss, request.u.open.id), &request, 'O', sizeof(request.u.open) + len);
 	return request.u.open.id;
 }
 
@@ -1573,6 +1953,7 @@ can_direct_write(struct socket *s, int id) {
 // return -1 when error, 0 when success
 int 
 socket_server_send(struct socket_server *ss, int id, const void * buffer, int sz) {
+	ss = SHARD(ss, id);
 	struct socket * s = &ss->slot[HASH_ID(id)];
 	if (s->id != id || s->type == SOCKET_TYPE_INVALID) {
 		free_buffer(ss, buffer, sz);
@@ -1618,9 +1999,14 @@ socket_server_send(struct socket_server *ss, int id, const void * buffer, int sz
 			s->dw_size = sz;
 			s->dw_offset = n;
 
-			sp_write(ss->event_fd, s->fd, s, true);
-
 			socket_unlock(&l);
+
+			// only the poll thread touches the event poll, ask it to enable write event
+			struct request_package request;
+			request.u.send.id = id;
+			request.u.send.sz = 0;
+			request.u.send.buffer = NULL;
+			send_request(ss, &request, 'W', sizeof(request.u.send));
 			return 0;
 		}
 		socket_unlock(&l);
@@ -1640,6 +2026,7 @@ socket_server_send(struct socket_server *ss, int id, const void * buffer, int sz
 // return -1 when error, 0 when success
 int 
 socket_server_send_lowpriority(struct socket_server *ss, int id, const void * buffer, int sz) {
+	ss = SHARD(ss, id);
 	struct socket * s = &ss->slot[HASH_ID(id)];
 	if (s->id != id || s->type == SOCKET_TYPE_INVALID) {
 		free_buffer(ss, buffer, sz);
@@ -1660,7 +2047,10 @@ socket_server_send_lowpriority(struct socket_server *ss, int id, const void * bu
 void
 socket_server_exit(struct socket_server *ss) {
 	struct request_package request;
-	send_request(ss, &request, 'X', 0);
+	int i;
+	for (i=0;i<ss->group->shards;i++) {
+		send_request(ss->group->shard[i], &request, 'X', 0);
+	}
 }
 
 void
@@ -1669,7 +2059,7 @@ socket_server_close(struct socket_server *ss, uintptr_t opaque, int id) {
 	request.u.close.id = id;
 	request.u.close.shutdown = 0;
 	request.u.close.opaque = opaque;
-	send_request(ss, &request, 'K', sizeof(request.u.close));
+	send_request(SHARD(ss, id), &request, 'K', sizeof(request.u.close));
 }
 
 
@@ -1679,7 +2069,7 @@ socket_server_shutdown(struct socket_server *ss, uintptr_t opaque, int id) {
 	request.u.close.id = id;
 	request.u.close.shutdown = 1;
 	request.u.close.opaque = opaque;
-	send_request(ss, &request, 'K', sizeof(request.u.close));
+	send_request(SHARD(ss, id), &request, 'K', sizeof(request.u.close));
 }
 
 // return -1 means failed
@@ -1760,7 +2150,7 @@ socket_server_listen(struct socket_server *ss, uintptr_t opaque, const char * ad
 	request.u.listen.opaque = opaque;
 	request.u.listen.id = id;
 	request.u.listen.fd = fd;
-	send_request(ss, &request, 'L', sizeof(request.u.listen));
+	send_request(SHARD(ss, id), &request, 'L', sizeof(request.u.listen));
 	return id;
 }
 
@@ -1773,7 +2163,7 @@ socket_server_bind(struct socket_server *ss, uintptr_t opaque, int fd) {
 	request.u.bind.opaque = opaque;
 	request.u.bind.id = id;
 	request.u.bind.fd = fd;
-	send_request(ss, &request, 'B', sizeof(request.u.bind));
+	send_request(SHARD(ss, id), &request, 'B', sizeof(request.u.bind));
 	return id;
 }
 
@@ -1782,7 +2172,7 @@ socket_server_start(struct socket_server *ss, uintptr_t opaque, int id) {
 	struct request_package request;
 	request.u.start.id = id;
 	request.u.start.opaque = opaque;
-	send_request(ss, &request, 'S', sizeof(request.u.start));
+	send_request(SHARD(ss, id), &request, 'S', sizeof(request.u.start));
 }
 
 void
@@ -1791,12 +2181,12 @@ socket_server_nodelay(struct socket_server *ss, int id) {
 	request.u.setopt.id = id;
 	request.u.setopt.what = TCP_NODELAY;
 	request.u.setopt.value = 1;
-	send_request(ss, &request, 'T', sizeof(request.u.setopt));
+	send_request(SHARD(ss, id), &request, 'T', sizeof(request.u.setopt));
 }
 
 void 
 socket_server_userobject(struct socket_server *ss, struct socket_object_interface *soi) {
-	ss->soi = *soi;
+	ss->group->soi = *soi;
 }
 
 // UDP
@@ -1831,12 +2221,13 @@ socket_server_udp(struct socket_server *ss, uintptr_t opaque, const char * addr,
 	request.u.udp.opaque = opaque;
 	request.u.udp.family = family;
 
-	send_request(ss, &request, 'U', sizeof(request.u.udp));	
+	send_request(SHARD(ss, id), &request, 'U', sizeof(request.u.udp));	
 	return id;
 }
 
 int 
 socket_server_udp_send(struct socket_server *ss, int id, const struct socket_udp_address *addr, const void *buffer, int sz) {
+	ss = SHARD(ss, id);
 	struct socket * s = &ss->slot[HASH_ID(id)];
 	if (s->id != id || s->type == SOCKET_TYPE_INVALID) {
 		free_buffer(ss, buffer, sz);
@@ -1899,6 +2290,7 @@ socket_server_udp_send(struct socket_server *ss, int id, const struct socket_udp
 
 int
 socket_server_udp_connect(struct socket_server *ss, int id, const char * addr, int port) {
+	ss = SHARD(ss, id);
 	struct socket * s = &ss->slot[HASH_ID(id)];
 	if (s->id != id || s->type == SOCKET_TYPE_INVALID) {
 		return -1;
@@ -22,9 +22,14 @@ struct socket_message {
 	char * data;
 };
 
-struct socket_server * socket_server_create(uint64_t time);
+// shards : number of poll threads, the sockets are sharded by id.
+// It returns the first shard, all the apis below can be called with any shard.
+struct socket_server * socket_server_create(uint64_t time, int shards);
+int socket_server_shards(struct socket_server *);
+struct socket_server * socket_server_shard(struct socket_server *, int index);
 void socket_server_release(struct socket_server *);
 void socket_server_updatetime(struct socket_server *, uint64_t time);
+// poll the sockets of this shard, call it in the poll thread of the shard
 int socket_server_poll(struct socket_server *, struct socket_message *result, int *more);
 
 void socket_server_exit(struct socket_server *);
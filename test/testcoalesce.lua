@@ -0,0 +1,35 @@
+local skynet = require "skynet"
+
+-- run it with timer_coalesce = true in config, the timeouts expire in the same tick come in one message
+
+skynet.start(function()
+	local N = 1000
+	local fired = 0
+	local woke = 0
+	skynet.sleep(1)	-- align to a tick
+	for i=1,N do
+		skynet.timeout(10, function()
+			fired = fired + 1
+			if i % 100 == 0 then
+				error("timeout " .. i .. " fails on purpose")
+			end
+		end)
+		skynet.fork(function()
+			skynet.sleep(10)
+			woke = woke + 1
+		end)
+	end
+	-- cancel some of them
+	local t = {}
+	for i=1,100 do
+		t[i] = skynet.timeout(10, function() error "cancelled timeout fired" end)
+	end
+	for i=1,100 do
+		t[i]:cancel()
+	end
+	skynet.sleep(50)
+	print("fired", fired, "woke", woke)
+	assert(fired == N and woke == N)
+	print("Test coalesce ok")
+	skynet.exit()
+end)
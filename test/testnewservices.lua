@@ -0,0 +1,76 @@
+local skynet = require "skynet"
+require "skynet.manager"
+
+local mode, parent = ...
+
+if mode == "child" then
+
+skynet.start(function()
+	local ticket = skynet.call(tonumber(parent), "lua", "ticket")
+	if ticket % 3 == 0 then
+		error("child " .. ticket .. " fails in init on purpose")
+	end
+	skynet.dispatch("lua", function (session, source, cmd)
+		if cmd == "ping" then
+			skynet.ret(skynet.pack(ticket))
+		else
+			assert(cmd == "exit")
+			skynet.exit()
+		end
+	end)
+end)
+
+else
+
+skynet.start(function()
+	local ticket = 0
+	skynet.dispatch("lua", function (session, source, cmd)
+		assert(cmd == "ticket")
+		ticket = ticket + 1
+		skynet.ret(skynet.pack(ticket))
+	end)
+
+	local N = 30
+	local children = skynet.newservices(SERVICE_NAME, N, "child", skynet.self())
+	assert(#children == N)
+	local failed = 0
+	local tickets = {}
+	for i, addr in ipairs(children) do
+		if addr then
+			local t = skynet.call(addr, "lua", "ping")
+			assert(t % 3 ~= 0 and not tickets[t])
+			tickets[t] = true
+		else
+			failed = failed + 1
+		end
+	end
+	assert(failed == N // 3, failed)
+
+	-- all of them fail
+	local addrs = skynet.newservices("nonexistent_service", 5)
+	assert(#addrs == 5)
+	for i = 1, 5 do
+		assert(addrs[i] == false)
+	end
+
+	-- the ones fail in C init (gate can't listen on the same port) keep their slots
+	local gates = skynet.launchn(3, "gate", "S ! 127.0.0.1:18767 0 8")
+	assert(#gates == 3 and gates[1] and gates[2] == false and gates[3] == false)
+	skynet.kill(gates[1])
+
+	-- invalid n
+	assert(not pcall(skynet.newservices, SERVICE_NAME, 0))
+
+	-- the launcher keeps only the alive ones
+	local list = skynet.call(".launcher", "lua", "LIST")
+	for _, addr in ipairs(children) do
+		if addr then
+			assert(list[skynet.address(addr)])
+			skynet.send(addr, "lua", "exit")
+		end
+	end
+	print("Test newservices ok")
+	skynet.exit()
+end)
+
+end
@@ -0,0 +1,83 @@
+local skynet = require "skynet"
+require "skynet.manager"
+
+local mode = ...
+
+if mode == "sub" then
+
+local count = 0
+
+skynet.start(function()
+	skynet.dispatch("lua", function (session, source, cmd, ...)
+		if cmd == "count" then
+			skynet.ret(skynet.pack(count))
+		else
+			assert(cmd == "hello", cmd)
+			count = count + 1
+		end
+	end)
+end)
+
+elseif mode == "forward" then
+
+skynet.register_protocol {
+	name = "system",
+	id = skynet.PTYPE_SYSTEM,
+	unpack = function (...) return ... end,
+}
+
+-- forward mode keeps the message (like clusterproxy), so it must get a copy of the shared payload
+skynet.forward_type({ [skynet.PTYPE_LUA] = skynet.PTYPE_SYSTEM }, function()
+	local target
+	skynet.dispatch("system", function (session, source, msg, sz)
+		if target == nil then
+			target = skynet.unpack(msg, sz)
+			skynet.trash(msg, sz)
+			skynet.ret()
+			return
+		end
+		skynet.ignoreret()
+		-- use the message after the other receivers have released the payload
+		skynet.timeout(10, function()
+			skynet.redirect(target, source, "lua", 0, msg, sz)
+		end)
+	end)
+end)
+
+else
+
+skynet.start(function()
+	local N = 10
+	local subs = {}
+	for i=1,N do
+		subs[i] = skynet.newservice(SERVICE_NAME, "sub")
+	end
+	skynet.name(".multisub", subs[1])
+	local fwd_target = skynet.newservice(SERVICE_NAME, "sub")
+	local fwd = skynet.newservice(SERVICE_NAME, "forward")
+	skynet.call(fwd, "lua", fwd_target)
+
+	local addrs = {}
+	for i=2,N do
+		addrs[#addrs+1] = subs[i]
+	end
+	addrs[#addrs+1] = ".multisub"
+	addrs[#addrs+1] = fwd
+	for i=1,100 do
+		assert(skynet.sendmulti(addrs, "lua", "hello") == #addrs)
+	end
+
+	-- an unknown address raises an error, instead of sending to handle 0
+	assert(not pcall(skynet.sendmulti, { subs[1], ".nonexistent" }, "lua", "hello"))
+	assert(not pcall(skynet.sendmulti, { subs[1], true }, "lua", "hello"))
+
+	skynet.sleep(50)
+	for i=1,N do
+		assert(skynet.call(subs[i], "lua", "count") == 100)
+	end
+	assert(skynet.call(fwd_target, "lua", "count") == 100)
+	print("Test sendmulti ok")
+	skynet.exit()
+end)
+
+end
@@ -0,0 +1,78 @@
+local skynet = require "skynet"
+
+-- run it with timer_resolution = 1 (and timer_tickless = true) in config
+
+local resolution = tonumber(skynet.getenv "timer_resolution")
+
+local function elapsed(f, ...)
+	local t = skynet.hpc()
+	f(...)
+	return (skynet.hpc() - t) / 1000000	-- in millisecond
+end
+
+local function test_sleep(ms, n)
+	local total = 0
+	local min = math.huge
+	for i=1,n do
+		local t = elapsed(skynet.sleep_ms, ms)
+		total = total + t
+		if t < min then
+			min = t
+		end
+	end
+	local avg = total / n
+	-- rounded up to the resolution, and the first tick may be partial
+	local expect = math.ceil(ms / resolution) * resolution
+	print(string.format("sleep_ms(%d) min %.2f avg %.2f ms", ms, min, avg))
+	assert(min >= expect - resolution, "wake up too early")
+	assert(avg < expect + resolution + 5, "wake up too late")
+end
+
+skynet.start(function()
+	print("timer resolution", resolution)
+	for _, ms in ipairs { 1, 2, 3, 5, 7, 15 } do
+		test_sleep(ms, 20)
+	end
+
+	-- timeout_ms
+	local N = 100
+	local fired = 0
+	local co = coroutine.running()
+	local t = skynet.hpc()
+	for i=1,N do
+		skynet.timeout_ms(i % 10 + 1, function()
+			fired = fired + 1
+			if fired == N then
+				skynet.wakeup(co)
+			end
+		end)
+	end
+	skynet.wait(co)
+	local ms = (skynet.hpc() - t) / 1000000
+	print(string.format("%d timeout_ms in %.2f ms", N, ms))
+	assert(ms < 10 + resolution + 20)
+
+	-- sleep after the timer thread is idle for a while (it sleeps up to 1s in tickless mode),
+	-- the first tick may be partial, and the wheel may lag a little behind the clock without tickless
+	local function idle(ms)
+		local t = skynet.hpc()
+		while skynet.hpc() - t < ms * 1000000 do end
+	end
+	for _, gap in ipairs { 300, 900 } do
+		idle(gap)
+		local ms = elapsed(skynet.sleep, 50)
+		print(string.format("sleep(50) after %d ms idle %.2f ms", gap, ms))
+		assert(ms >= 500 - 2 * resolution, "wake up too early")
+		idle(gap)
+		ms = elapsed(skynet.sleep_ms, 50)
+		print(string.format("sleep_ms(50) after %d ms idle %.2f ms", gap, ms))
+		assert(ms >= 50 - 2 * resolution, "wake up too early")
+	end
+
+	-- sleep is still in centisecond
+	local ms = elapsed(skynet.sleep, 2)
+	print(string.format("sleep(2) %.2f ms", ms))
+	assert(ms >= 10)
+	print("Test sleep_ms ok")
+	skynet.exit()
+end)
@@ -0,0 +1,92 @@
+local skynet = require "skynet"
+local socket = require "skynet.socket"
+
+-- build with -DUSE_IOURING to test the recv path of io_uring backend
+
+local mode, port = ...
+
+if mode == "client" then
+
+skynet.start(function()
+	skynet.dispatch("lua", function(_,_, id)
+		local fd = assert(socket.open("127.0.0.1", tonumber(port)))
+		-- many small lines
+		local M = 200
+		for i=1,M do
+			socket.write(fd, string.format("%d-%d\n", id, i))
+		end
+		for i=1,M do
+			local line = socket.readline(fd)
+			assert(line == string.format("%d-%d", id, i), line)
+		end
+		-- a big line, more than the buffers of backend
+		socket.write(fd, string.rep("x", 1024*1024) .. "\n")
+		assert(#socket.readline(fd) == 1024*1024)
+		-- high then many low priority pieces
+		socket.write(fd, string.rep("h", 512*1024))
+		for i=1,1000 do
+			socket.lwrite(fd, string.rep("y", 100))
+		end
+		socket.lwrite(fd, "\n")
+		local line = socket.readline(fd)
+		assert(#line == 512*1024 + 100000 and line:sub(-100) == string.rep("y", 100), #line)
+		socket.close(fd)
+		skynet.ret(skynet.pack(true))
+	end)
+end)
+
+else
+
+local PORT = 18765
+
+skynet.start(function()
+	local lfd = socket.listen("127.0.0.1", PORT)
+	socket.start(lfd, function(fd, addr)
+		skynet.fork(function()
+			socket.start(fd)
+			while true do
+				local line = socket.readline(fd)
+				if not line then
+					break
+				end
+				socket.write(fd, line .. "\n")
+			end
+			socket.close(fd)
+		end)
+	end)
+
+	-- udp sockets are polled
+	local echo
+	echo = socket.udp(function(str, from)
+		socket.sendto(echo, from, str)
+	end, "127.0.0.1", PORT+1)
+	local got = 0
+	local c = socket.udp(function(str)
+		got = got + 1
+	end)
+	socket.udp_connect(c, "127.0.0.1", PORT+1)
+	for i=1,50 do
+		socket.write(c, tostring(i))
+	end
+
+	local N = 64
+	local done = 0
+	for i=1,N do
+		local client = skynet.newservice(SERVICE_NAME, "client", PORT)
+		skynet.fork(function()
+			assert(skynet.call(client, "lua", i))
+			done = done + 1
+		end)
+	end
+	while done < N do
+		skynet.sleep(10)
+	end
+	assert(got == 50, got)
+	socket.close(c)
+	socket.close(echo)
+	socket.close(lfd)
+	print("Test socket echo ok")
+	skynet.exit()
+end)
+
+end
@@ -0,0 +1,50 @@
+local skynet = require "skynet"
+
+local function busy(ti)
+	-- block the service, so the timeout message is on the way when cancelling
+	local t = skynet.now() + ti
+	while skynet.now() < t do end
+end
+
+skynet.start(function()
+	local fired = 0
+	local function inc() fired = fired + 1 end
+
+	-- cancel before it fires
+	local t = skynet.timeout(10, function() error "cancelled timeout fired" end)
+	assert(t:cancel() == true)
+	assert(t:cancel() == false)	-- cancel twice
+
+	-- cancel after it fires
+	t = skynet.timeout(1, inc)
+	skynet.sleep(10)
+	assert(fired == 1)
+	assert(t:cancel() == false)
+
+	-- the timer fires while the service is busy, the message is dropped
+	t = skynet.timeout(1, function() error "cancelled timeout fired" end)
+	busy(5)
+	assert(t:cancel() == true)
+
+	-- millisecond timer
+	t = skynet.timeout_ms(20, function() error "cancelled timeout fired" end)
+	assert(t:cancel() == true)
+
+	-- cancel the others in a timer callback
+	local N = 100
+	local timers = {}
+	for i=1,N do
+		timers[i] = skynet.timeout(20, function() error "cancelled timeout fired" end)
+	end
+	skynet.timeout(10, function()
+		for i=1,N do
+			assert(timers[i]:cancel() == true)
+		end
+		inc()
+	end)
+
+	skynet.sleep(50)
+	assert(fired == 2, fired)
+	print("Test timer cancel ok")
+	skynet.exit()
+end)